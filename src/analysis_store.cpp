@@ -0,0 +1,290 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2020 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>   // For std::memcmp
+#include <deque>
+#include <fstream>
+#include <unordered_map>
+
+#include "analysis_store.h"
+#include "misc.h"
+#include "position.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#ifndef NOMINMAX
+#  define NOMINMAX // Disable macros min() and max()
+#endif
+#include <windows.h>
+#endif
+
+namespace {
+
+// Shallower results are found again quickly, they are not worth a record
+constexpr Depth MinDepth = 10;
+constexpr int MaxPvLength = 40;
+constexpr char FileMagic[8] = { 'S', 'F', 'A', 'N', 'A', 'L', 'Y', '1' };
+
+// Record is the layout of a stored result in the file, after the magic
+struct Record {
+  uint64_t key;
+  uint8_t  rule50;
+  uint8_t  depth;
+  uint8_t  bound;
+  uint8_t  pvLength;
+  int16_t  score;
+  uint16_t pv[MaxPvLength];
+  uint16_t padding;
+};
+
+static_assert(sizeof(Record) == 96, "Unexpected Record size");
+
+// The records found at startup are read through the mapping, the ones stored
+// since then live in Appended. Index points to the deepest record of every
+// position.
+void* BaseAddress;
+uint64_t Mapping;
+std::deque<Record> Appended;
+std::unordered_map<Key, const Record*> Index;
+std::ofstream StoreFile;
+
+int rule50_bucket(const Position& pos) {
+  return std::min(pos.rule50_count(), 99) / 10;
+}
+
+Key index_key(Key key, int bucket) {
+  return key ^ (Key(bucket) * 0x9E3779B97F4A7C15ULL);
+}
+
+void insert(const Record* r) {
+
+  const Record*& slot = Index[index_key(r->key, r->rule50)];
+  if (!slot || slot->depth <= r->depth)
+      slot = r;
+}
+
+const Record* find(const Position& pos) {
+
+  const int bucket = rule50_bucket(pos);
+  auto it = Index.find(index_key(pos.key(), bucket));
+
+  return   it != Index.end()
+        && it->second->key == pos.key()
+        && it->second->rule50 == bucket ? it->second : nullptr;
+}
+
+// map() maps the file read-only. A missing or empty file gives size 0 and
+// nothing is mapped. Returns false if an existing file could not be mapped.
+
+bool map(const std::string& path, size_t& size) {
+
+  size = 0;
+
+#ifndef _WIN32
+  struct stat statbuf;
+  int fd = ::open(path.c_str(), O_RDONLY);
+
+  if (fd == -1)
+      return true;
+
+  if (fstat(fd, &statbuf) || statbuf.st_size == 0)
+  {
+      ::close(fd);
+      return true;
+  }
+
+  BaseAddress = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (BaseAddress == MAP_FAILED)
+      return BaseAddress = nullptr, false;
+
+  Mapping = size = statbuf.st_size;
+#else
+  // Share writing with ourselves, we append to the file while it is mapped
+  HANDLE fd = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                         nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+
+  if (fd == INVALID_HANDLE_VALUE)
+      return true;
+
+  DWORD size_high;
+  DWORD size_low = GetFileSize(fd, &size_high);
+
+  if (!size_low && !size_high)
+  {
+      CloseHandle(fd);
+      return true;
+  }
+
+  HANDLE mmap = CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high, size_low, nullptr);
+  CloseHandle(fd);
+
+  if (!mmap)
+      return false;
+
+  BaseAddress = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
+
+  if (!BaseAddress)
+  {
+      CloseHandle(mmap);
+      return false;
+  }
+
+  Mapping = (uint64_t)mmap;
+  size = size_t(uint64_t(size_high) << 32 | size_low);
+#endif
+
+  return true;
+}
+
+void unmap() {
+
+  if (!BaseAddress)
+      return;
+
+#ifndef _WIN32
+  munmap(BaseAddress, Mapping);
+#else
+  UnmapViewOfFile(BaseAddress);
+  CloseHandle((HANDLE)Mapping);
+#endif
+
+  BaseAddress = nullptr;
+}
+
+} // namespace
+
+
+/// AnalysisStore::init() opens the store in the given file, creating it if
+/// needed, and indexes its records. An empty path closes the store.
+
+void AnalysisStore::init(const std::string& path) {
+
+  Index.clear();
+  Appended.clear();
+  StoreFile.close();
+  unmap();
+
+  if (path.empty() || path == "<empty>")
+      return;
+
+  size_t size;
+  if (   !map(path, size)
+      || (size && (size < sizeof(FileMagic) || std::memcmp(BaseAddress, FileMagic, sizeof(FileMagic)))))
+  {
+      sync_cout << "info string Could not open analysis file " << path << sync_endl;
+      unmap();
+      return;
+  }
+
+  const Record* records = reinterpret_cast<const Record*>(
+                          static_cast<const char*>(BaseAddress) + sizeof(FileMagic));
+  const size_t count = size ? (size - sizeof(FileMagic)) / sizeof(Record) : 0;
+
+  for (size_t i = 0; i < count; ++i)
+      insert(&records[i]);
+
+  // A record cut short, e.g. by a crash, would shift all the following ones
+  if (size && (size - sizeof(FileMagic)) % sizeof(Record))
+      sync_cout << "info string Analysis file " << path
+                << " ends with a partial record, new results are not stored" << sync_endl;
+  else
+  {
+      StoreFile.open(path, std::ios::binary | std::ios::app);
+
+      if (!size)
+          StoreFile.write(FileMagic, sizeof(FileMagic)).flush();
+  }
+
+  sync_cout << "info string Analysis file " << path << " with "
+            << Index.size() << " positions" << sync_endl;
+}
+
+
+/// AnalysisStore::probe() looks up the position and fills e with the stored
+/// result. Only the legal part of the stored PV is returned, so that a key
+/// collision gives an empty PV and the probe fails.
+
+bool AnalysisStore::probe(Position& pos, Entry& e) {
+
+  const Record* r = find(pos);
+
+  if (!r)
+      return false;
+
+  e.depth = Depth(r->depth);
+  e.score = Value(r->score);
+  e.bound = Bound(r->bound);
+  e.pv.clear();
+
+  std::vector<StateInfo, AlignedAllocator<StateInfo>> states(r->pvLength);
+
+  for (int i = 0; i < r->pvLength; ++i)
+  {
+      Move m = Move(r->pv[i]);
+
+      if (!pos.pseudo_legal(m) || !pos.legal(m))
+          break;
+
+      e.pv.push_back(m);
+      pos.do_move(m, states[i]);
+  }
+
+  for (auto it = e.pv.rbegin(); it != e.pv.rend(); ++it)
+      pos.undo_move(*it);
+
+  return !e.pv.empty();
+}
+
+
+/// AnalysisStore::save() appends the result if it is deeper than the stored one
+
+void AnalysisStore::save(const Position& pos, const Entry& e) {
+
+  if (!StoreFile.is_open() || e.depth < MinDepth || e.pv.empty())
+      return;
+
+  const Record* old = find(pos);
+
+  if (old && old->depth >= e.depth)
+      return;
+
+  Record r = {};
+  r.key      = pos.key();
+  r.rule50   = uint8_t(rule50_bucket(pos));
+  r.depth    = uint8_t(e.depth);
+  r.bound    = uint8_t(e.bound);
+  r.score    = int16_t(e.score);
+  r.pvLength = uint8_t(std::min(e.pv.size(), size_t(MaxPvLength)));
+
+  for (int i = 0; i < r.pvLength; ++i)
+      r.pv[i] = uint16_t(e.pv[i]);
+
+  StoreFile.write(reinterpret_cast<const char*>(&r), sizeof(r)).flush();
+
+  Appended.push_back(r);
+  insert(&Appended.back());
+}
@@ -0,0 +1,52 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2020 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ANALYSIS_STORE_H_INCLUDED
+#define ANALYSIS_STORE_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+class Position;
+
+/// The analysis store is an append-only file with the result of the deepest
+/// completed iteration for every root position searched while it is enabled
+/// with the AnalysisFile option. Positions are identified by their key and a
+/// bucket of the 50-move counter. The file as found at startup is memory
+/// mapped, the results stored afterwards are also kept in memory.
+
+namespace AnalysisStore {
+
+struct Entry {
+  Depth depth;
+  Value score; // From the point of view of the side to move
+  Bound bound;
+  std::vector<Move> pv;
+};
+
+void init(const std::string& path);
+bool probe(Position& pos, Entry& e);
+void save(const Position& pos, const Entry& e);
+
+} // namespace AnalysisStore
+
+#endif // #ifndef ANALYSIS_STORE_H_INCLUDED
@@ -92,6 +92,17 @@ const vector<string> Defaults = {
   "setoption name UCI_Chess960 value false"
 };
 
+// Forced mates in at most 3 moves, for the proof-number mate solver
+const vector<string> Mates = {
+  "setoption name MateSolver value true",
+  "1k6/ppp5/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+  "r2qkb1r/pp2nppp/3p4/2pNN1B1/2BnP3/3P4/PPP2PPP/R2bK2R w KQkq - 1 10",
+  "6k1/pp4p1/2p5/2bp4/8/P5Pb/1P3rrP/2BRRN1K b - - 0 1",
+  "r1b1kb1r/pppp1ppp/5q2/4n3/3KP3/2N3PN/PPP4P/R1BQ1B1R b kq - 0 1",
+  "r5rk/5p1p/5R2/4B3/8/8/7P/7K w - - 0 1",
+  "2r3k1/p4p2/3Rp2p/1p2P1pK/8/1P4P1/P3Q2P/1q6 b - - 0 1"
+};
+
 } // namespace
 
 /// setup_bench() builds a list of UCI commands to be run by bench. There
@@ -105,6 +116,7 @@ const vector<string> Defaults = {
 /// bench 64 4 5000 current movetime -> search current position with 4 threads for 5 sec
 /// bench 64 1 100000 default nodes -> search default positions for 100K nodes each
 /// bench 16 1 5 default perft -> run a perft 5 on default positions
+/// bench 16 4 3 mates mate -> solve the default mate problems with the mate solver
 
 vector<string> setup_bench(const Position& current, istream& is) {
 
@@ -123,6 +135,9 @@ vector<string> setup_bench(const Position& current, istream& is) {
   if (fenFile == "default")
       fens = Defaults;
 
+  else if (fenFile == "mates")
+      fens = Mates;
+
   else if (fenFile == "current")
       fens.push_back(current.fen());
 
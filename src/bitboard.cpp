@@ -20,10 +20,19 @@
 
 #include <algorithm>
 #include <bitset>
+#include <cstring>   // For std::memcpy, std::strcmp
 
 #include "bitboard.h"
 #include "misc.h"
 
+#if defined(USE_PEXT)
+#  if defined(_MSC_VER)
+#    include <intrin.h> // Microsoft header for __cpuid()
+#  else
+#    include <cpuid.h>  // GCC and Clang header for __cpuid()
+#  endif
+#endif
+
 uint8_t PopCnt16[1 << 16];
 uint8_t SquareDistance[SQUARE_NB][SQUARE_NB];
 
@@ -40,7 +49,21 @@ namespace {
   Bitboard RookTable[0x19000];  // To store rook attacks
   Bitboard BishopTable[0x1480]; // To store bishop attacks
 
-  void init_magics(PieceType pt, Bitboard table[], Magic magics[]);
+  // The same attacks indexed with pext, only needed when pext is available
+  Bitboard RookPextTable[HasPext ? 0x19000 : 1];
+  Bitboard BishopPextTable[HasPext ? 0x1480 : 1];
+
+  void init_magics(PieceType pt, Bitboard table[], Bitboard pextTable[], Magic magics[]);
+
+  // switch_table() points m to the table matching the indexing method. Both
+  // tables use the same offset for every square.
+  void switch_table(Magic& m, Bitboard table[], Bitboard pextTable[], bool enable) {
+
+    Bitboard* current = m.usePext ? pextTable : table;
+
+    m.attacks = (enable ? pextTable : table) + (m.attacks - current);
+    m.usePext = enable;
+  }
 }
 
 
@@ -79,8 +102,8 @@ void Bitboards::init() {
       for (Square s2 = SQ_A1; s2 <= SQ_H8; ++s2)
           SquareDistance[s1][s2] = std::max(distance<File>(s1, s2), distance<Rank>(s1, s2));
 
-  init_magics(ROOK, RookTable, RookMagics);
-  init_magics(BISHOP, BishopTable, BishopMagics);
+  init_magics(ROOK, RookTable, RookPextTable, RookMagics);
+  init_magics(BISHOP, BishopTable, BishopPextTable, BishopMagics);
 
   for (Square s1 = SQ_A1; s1 <= SQ_H8; ++s1)
   {
@@ -101,6 +124,74 @@ void Bitboards::init() {
               if (PseudoAttacks[pt][s1] & s2)
                   LineBB[s1][s2] = (attacks_bb(pt, s1, 0) & attacks_bb(pt, s2, 0)) | s1 | s2;
   }
+
+  use_pext(pext_is_fast());
+}
+
+
+/// Bitboards::use_pext() selects how the sliding attacks are looked up: with
+/// the pext instruction or with a magic multiplication. Both tables are built
+/// at startup when the binary is compiled with pext support. The magics are
+/// switched one by one, so no search may run meanwhile.
+
+void Bitboards::use_pext(bool enable) {
+
+  enable = enable && HasPext;
+
+  for (Square s = SQ_A1; s <= SQ_H8; ++s)
+  {
+      switch_table(RookMagics[s], RookTable, RookPextTable, enable);
+      switch_table(BishopMagics[s], BishopTable, BishopPextTable, enable);
+  }
+}
+
+
+/// Bitboards::uses_pext() returns true if the sliding attacks are looked up
+/// with pext.
+
+bool Bitboards::uses_pext() {
+  return HasPext && RookMagics[SQ_A1].usePext;
+}
+
+
+/// Bitboards::pext_is_fast() returns true if pext is expected to be faster than
+/// a magic multiplication on this CPU. AMD implements pext in microcode before
+/// Zen 3 (family 19h), with a latency that grows with the bits of the mask.
+
+bool Bitboards::pext_is_fast() {
+
+#if defined(USE_PEXT)
+  unsigned regs[4]; // eax, ebx, ecx, edx
+  char vendor[13] = {};
+
+#  if defined(_MSC_VER)
+  __cpuid(reinterpret_cast<int*>(regs), 0);
+#  else
+  __cpuid(0, regs[0], regs[1], regs[2], regs[3]);
+#  endif
+
+  std::memcpy(vendor, &regs[1], 4);
+  std::memcpy(vendor + 4, &regs[3], 4);
+  std::memcpy(vendor + 8, &regs[2], 4);
+
+  if (   std::strcmp(vendor, "AuthenticAMD")
+      && std::strcmp(vendor, "HygonGenuine"))
+      return true;
+
+#  if defined(_MSC_VER)
+  __cpuid(reinterpret_cast<int*>(regs), 1);
+#  else
+  __cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#  endif
+
+  unsigned family = (regs[0] >> 8) & 0xF;
+  if (family == 0xF)
+      family += (regs[0] >> 20) & 0xFF;
+
+  return family >= 0x19;
+#else
+  return false;
+#endif
 }
 
 
@@ -128,7 +219,7 @@ namespace {
   // www.chessprogramming.org/Magic_Bitboards. In particular, here we use the so
   // called "fancy" approach.
 
-  void init_magics(PieceType pt, Bitboard table[], Magic magics[]) {
+  void init_magics(PieceType pt, Bitboard table[], Bitboard pextTable[], Magic magics[]) {
 
     // Optimal PRNG seeds to pick the correct magics in the shortest time
     int seeds[][RANK_NB] = { { 8977, 44560, 54343, 38998,  5731, 95205, 104912, 17020 },
@@ -150,6 +241,7 @@ namespace {
         Magic& m = magics[s];
         m.mask  = sliding_attack(pt, s, 0) & ~edges;
         m.shift = (Is64Bit ? 64 : 32) - popcount(m.mask);
+        m.usePext = false;
 
         // Set the offset for the attacks table of the square. We have individual
         // table sizes for each square with "Fancy Magic Bitboards".
@@ -163,15 +255,12 @@ namespace {
             reference[size] = sliding_attack(pt, s, b);
 
             if (HasPext)
-                m.attacks[pext(b, m.mask)] = reference[size];
+                pextTable[(m.attacks - table) + pext(b, m.mask)] = reference[size];
 
             size++;
             b = (b - m.mask) & m.mask;
         } while (b);
 
-        if (HasPext)
-            continue;
-
         PRNG rng(seeds[Is64Bit][rank_of(s)]);
 
         // Find a magic for square 's' picking up an (almost) random number
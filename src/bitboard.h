@@ -35,6 +35,9 @@ bool probe(Square wksq, Square wpsq, Square bksq, Color us);
 namespace Bitboards {
 
 void init();
+void use_pext(bool enable);
+bool uses_pext();
+bool pext_is_fast();
 const std::string pretty(Bitboard b);
 
 }
@@ -86,11 +89,12 @@ struct Magic {
   Bitboard  magic;
   Bitboard* attacks;
   unsigned  shift;
+  bool      usePext; // Kept here, in the same cache line as the mask
 
   // Compute the attack's index using the 'magic bitboards' approach
   unsigned index(Bitboard occupied) const {
 
-    if (HasPext)
+    if (HasPext && usePext)
         return unsigned(pext(occupied, mask));
 
     if (Is64Bit)
@@ -0,0 +1,42 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2020 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOOK_H_INCLUDED
+#define BOOK_H_INCLUDED
+
+#include <string>
+
+#include "types.h"
+
+class Position;
+
+/// Book reads an opening book in the PolyGlot format, set with the BookFile
+/// option. The file is memory mapped and never read as a whole, the entries of
+/// a position are found with a binary search on the sorted keys. Book moves are
+/// played by the search and gensfen for the first BookMoves plies of a game.
+
+namespace Book {
+
+void init(const std::string& path);
+Move probe(const Position& pos, uint64_t rand, bool pickBest);
+
+} // namespace Book
+
+#endif // #ifndef BOOK_H_INCLUDED
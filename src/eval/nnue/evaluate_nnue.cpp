@@ -7,11 +7,43 @@
 
 #include "../../evaluate.h"
 #include "../../position.h"
+#include "../../thread.h"
 #include "../../misc.h"
 #include "../../uci.h"
 
 #include "evaluate_nnue.h"
 
+#if defined(EMBEDDED_NNUE)
+// The default network, linked into the binary by the Makefile ("embed=yes").
+// The blob is padded so that the feature transformer parameters, which follow
+// a header of 16 + EMBEDDED_NNUE_ARCH_SIZE bytes, start on a cache line and
+// can be used in place.
+#define EMBEDDED_NNUE_STR2(x) #x
+#define EMBEDDED_NNUE_STR(x) EMBEDDED_NNUE_STR2(x)
+#if defined(__APPLE__)
+#define EMBEDDED_NNUE_SECTION ".const_data\n"
+#define EMBEDDED_NNUE_SYMBOL(name) "_" #name
+#elif defined(_WIN32)
+#define EMBEDDED_NNUE_SECTION ".section .rdata\n"
+#define EMBEDDED_NNUE_SYMBOL(name) #name
+#else
+#define EMBEDDED_NNUE_SECTION ".section .rodata\n"
+#define EMBEDDED_NNUE_SYMBOL(name) #name
+#endif
+asm(EMBEDDED_NNUE_SECTION
+    ".balign 64\n"
+    ".skip (64 - (16 + " EMBEDDED_NNUE_STR(EMBEDDED_NNUE_ARCH_SIZE) ") % 64) % 64\n"
+    ".global " EMBEDDED_NNUE_SYMBOL(gEmbeddedNNUEData) "\n"
+    EMBEDDED_NNUE_SYMBOL(gEmbeddedNNUEData) ":\n"
+    ".incbin \"" EMBEDDED_NNUE_STR(EMBEDDED_NNUE_FILE) "\"\n"
+    ".global " EMBEDDED_NNUE_SYMBOL(gEmbeddedNNUEEnd) "\n"
+    EMBEDDED_NNUE_SYMBOL(gEmbeddedNNUEEnd) ":\n"
+    ".byte 0\n"
+    ".text\n");
+extern "C" const char gEmbeddedNNUEData[];
+extern "C" const char gEmbeddedNNUEEnd[];
+#endif
+
 namespace Eval {
 
 namespace NNUE {
@@ -62,10 +94,64 @@ bool WriteParameters(std::ostream& stream, const AlignedPtr<T>& pointer) {
   return pointer->WriteParameters(stream);
 }
 
+// read compressed evaluation function parameters
+template <typename T>
+bool ReadCompressedParameters(std::istream& stream, const AlignedPtr<T>& pointer) {
+  std::uint32_t header;
+  stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!stream || header != T::GetHashValue()) return false;
+  return pointer->ReadCompressedParameters(stream);
+}
+
+// write compressed evaluation function parameters
+template <typename T>
+bool WriteCompressedParameters(std::ostream& stream, const AlignedPtr<T>& pointer) {
+  constexpr std::uint32_t header = T::GetHashValue();
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  return pointer->WriteCompressedParameters(stream);
+}
+
 }  // namespace Detail
 
+#if defined(EMBEDDED_NNUE)
+// True while feature_transformer points into the embedded network.
+// That memory is not ours, so it must be released rather than freed.
+bool feature_transformer_in_place = false;
+
+// Read-only stream over the embedded network, so that nothing is copied
+struct MemoryStreamBuffer : std::streambuf {
+  MemoryStreamBuffer(const char* begin, const char* end) {
+    setg(const_cast<char*>(begin), const_cast<char*>(begin),
+         const_cast<char*>(end));
+  }
+
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode /*which*/) override {
+    char* const base = dir == std::ios_base::beg ? eback() :
+                       dir == std::ios_base::cur ? gptr() : egptr();
+    if (off < eback() - base || off > egptr() - base) {
+      return pos_type(off_type(-1));
+    }
+    setg(eback(), base + off, egptr());
+    return pos_type(gptr() - eback());
+  }
+};
+#endif
+
+// Drop the current feature transformer parameters
+void ReleaseFeatureTransformer() {
+#if defined(EMBEDDED_NNUE)
+  if (feature_transformer_in_place) {
+    feature_transformer.release();
+    feature_transformer_in_place = false;
+  }
+#endif
+  feature_transformer.reset();
+}
+
 // Initialize the evaluation function parameters
 void Initialize() {
+  ReleaseFeatureTransformer();
   Detail::Initialize(feature_transformer);
   Detail::Initialize(network);
 }
@@ -74,12 +160,19 @@ void Initialize() {
 
 // read the header
 bool ReadHeader(std::istream& stream,
-  std::uint32_t* hash_value, std::string* architecture) {
+  std::uint32_t* hash_value, std::string* architecture, bool* compressed) {
   std::uint32_t version, size;
   stream.read(reinterpret_cast<char*>(&version), sizeof(version));
   stream.read(reinterpret_cast<char*>(hash_value), sizeof(*hash_value));
   stream.read(reinterpret_cast<char*>(&size), sizeof(size));
-  if (!stream || version != kVersion) return false;
+  if (!stream) return false;
+  if (version == kCompressedVersion && compressed) {
+    *compressed = true;
+  } else if (version == kVersion) {
+    if (compressed) *compressed = false;
+  } else {
+    return false;
+  }
   architecture->resize(size);
   stream.read(&(*architecture)[0], size);
   return !stream.fail();
@@ -87,8 +180,9 @@ bool ReadHeader(std::istream& stream,
 
 // write the header
 bool WriteHeader(std::ostream& stream,
-  std::uint32_t hash_value, const std::string& architecture) {
-  stream.write(reinterpret_cast<const char*>(&kVersion), sizeof(kVersion));
+  std::uint32_t hash_value, const std::string& architecture, bool compressed) {
+  const std::uint32_t version = compressed ? kCompressedVersion : kVersion;
+  stream.write(reinterpret_cast<const char*>(&version), sizeof(version));
   stream.write(reinterpret_cast<const char*>(&hash_value), sizeof(hash_value));
   const std::uint32_t size = static_cast<std::uint32_t>(architecture.size());
   stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
@@ -98,23 +192,78 @@ bool WriteHeader(std::ostream& stream,
 
 // read evaluation function parameters
 bool ReadParameters(std::istream& stream) {
+#if defined(EMBEDDED_NNUE)
+  // Never read into the read-only embedded network
+  if (feature_transformer_in_place) Initialize();
+#endif
   std::uint32_t hash_value;
   std::string architecture;
-  if (!ReadHeader(stream, &hash_value, &architecture)) return false;
+  bool compressed;
+  if (!ReadHeader(stream, &hash_value, &architecture, &compressed)) return false;
   if (hash_value != kHashValue) return false;
-  if (!Detail::ReadParameters(stream, feature_transformer)) return false;
+  if (compressed) {
+    if (!Detail::ReadCompressedParameters(stream, feature_transformer)) return false;
+  } else {
+    if (!Detail::ReadParameters(stream, feature_transformer)) return false;
+  }
   if (!Detail::ReadParameters(stream, network)) return false;
   return stream && stream.peek() == std::ios::traits_type::eof();
 }
 
 // write evaluation function parameters
-bool WriteParameters(std::ostream& stream) {
-  if (!WriteHeader(stream, kHashValue, GetArchitectureString())) return false;
-  if (!Detail::WriteParameters(stream, feature_transformer)) return false;
+bool WriteParameters(std::ostream& stream, bool compressed) {
+  if (!WriteHeader(stream, kHashValue, GetArchitectureString(), compressed)) return false;
+  if (compressed) {
+    if (!Detail::WriteCompressedParameters(stream, feature_transformer)) return false;
+  } else {
+    if (!Detail::WriteParameters(stream, feature_transformer)) return false;
+  }
   if (!Detail::WriteParameters(stream, network)) return false;
   return !stream.fail();
 }
 
+#if defined(EMBEDDED_NNUE)
+// read evaluation function parameters from the network linked into the binary.
+// When the layout allows it, the feature transformer is used in place.
+bool ReadEmbeddedParameters() {
+  MemoryStreamBuffer buffer(gEmbeddedNNUEData, gEmbeddedNNUEEnd);
+  std::istream stream(&buffer);
+
+  std::uint32_t hash_value;
+  std::string architecture;
+  bool compressed;
+  if (!ReadHeader(stream, &hash_value, &architecture, &compressed)) return false;
+  if (hash_value != kHashValue) return false;
+
+  // The learner writes to the parameters, and the embedded blob is read-only.
+#if !defined(EVAL_LEARN)
+  const char* parameters =
+      gEmbeddedNNUEData + stream.tellg() + sizeof(std::uint32_t);
+  if (!compressed && FeatureTransformer::IsLayoutSameAsFile() &&
+      reinterpret_cast<std::uintptr_t>(parameters) %
+          alignof(FeatureTransformer) == 0) {
+    std::uint32_t header;
+    stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!stream || header != FeatureTransformer::GetHashValue()) return false;
+
+    ReleaseFeatureTransformer();
+    Detail::Initialize(network);
+    feature_transformer.reset(reinterpret_cast<FeatureTransformer*>(
+        const_cast<char*>(parameters)));
+    feature_transformer_in_place = true;
+    stream.seekg(sizeof(FeatureTransformer), std::ios::cur);
+
+    if (!Detail::ReadParameters(stream, network)) return false;
+    return stream && stream.peek() == std::ios::traits_type::eof();
+  }
+#endif
+
+  stream.seekg(0);
+  Initialize();
+  return ReadParameters(stream);
+}
+#endif
+
 // proceed if you can calculate the difference
 static void UpdateAccumulatorIfPossible(const Position& pos) {
   feature_transformer->UpdateAccumulatorIfPossible(pos);
@@ -129,7 +278,9 @@ static Value ComputeScore(const Position& pos, bool refresh = false) {
 
   alignas(kCacheLineSize) TransformedFeatureType
       transformed_features[FeatureTransformer::kBufferSize];
-  feature_transformer->Transform(pos, transformed_features, refresh);
+  if (feature_transformer->Transform(pos, transformed_features, refresh)) {
+    pos.this_thread()->counters.count(NNUE_REFRESHES);
+  }
   alignas(kCacheLineSize) char buffer[Network::kBufferSize];
   const auto output = network->Propagate(transformed_features, buffer);
 
@@ -230,11 +381,32 @@ void prefetch_evalhash(const Key key) {
 }
 #endif
 
+bool useEvalHash;
+bool useNNUE = true;
+
 // read the evaluation function file
 // Save and restore Options with bench command etc., so EvalDir is changed at this time,
 // This function may be called twice to flag that the evaluation function needs to be reloaded.
 void load_eval() {
 
+  const std::string file_name = Options["EvalFile"];
+
+#if defined(EMBEDDED_NNUE)
+  // The embedded network is used in place, so skip the allocation below.
+  if (file_name == NNUE::kEmbeddedFileName && !Options["SkipLoadingEval"])
+  {
+      NNUE::fileName = file_name;
+      if (NNUE::ReadEmbeddedParameters())
+          std::cout << "info string NNUE embedded network loaded" << std::endl;
+      else
+      {
+          NNUE::Initialize();
+          std::cout << "info string Error! embedded network has a wrong format" << std::endl;
+      }
+      return;
+  }
+#endif
+
   // Must be done!
   NNUE::Initialize();
 
@@ -244,7 +416,6 @@ void load_eval() {
       return;
   }
 
-  const std::string file_name = Options["EvalFile"];
   NNUE::fileName = file_name;
 
   std::ifstream stream(file_name, std::ios::binary);
@@ -255,7 +426,15 @@ void load_eval() {
       std::cout << "info string Error! " << NNUE::fileName << " not found or wrong format" << std::endl;
 
   else
+  {
       std::cout << "info string NNUE " << NNUE::fileName << " found & loaded" << std::endl;
+#if defined(USE_COMPACT_FEATURES)
+      std::cout << "info string NNUE compact layout, "
+                << NNUE::feature_transformer->GetNumUsedColumns() << " of "
+                << NNUE::FeatureTransformer::kInputDimensions
+                << " weight columns stored" << std::endl;
+#endif
+  }
 }
 
 // Initialization
@@ -286,7 +465,7 @@ Value NNUE::evaluate(const Position& pos) {
   }
 #endif
 
-  if (Options["UseEvalHash"]) {
+  if (useEvalHash) {
       // May be in the evaluate hash table.
       const Key key = pos.key();
       ScoreKeyValue entry = *g_evalTable[key];
@@ -313,6 +492,63 @@ void evaluate_with_no_return(const Position& pos) {
   NNUE::UpdateAccumulatorIfPossible(pos);
 }
 
+// prefetch the feature transformer columns touched by the last move
+void prefetch_feature_weights(const Position& pos) {
+  if (NNUE::feature_transformer)
+    NNUE::feature_transformer->PrefetchChangedColumns(pos, pos.state()->dirtyPiece);
+}
+
+namespace {
+
+// Fill dp as do_move() would for the move m, without making it. Returns false
+// for the king moves, after which the accumulator is computed from scratch.
+bool predict_dirty_piece(const Position& pos, Move m, DirtyPiece& dp) {
+  const Square from = from_sq(m);
+  const Square to = to_sq(m);
+  const Piece pc = pos.moved_piece(m);
+  const auto list = pos.eval_list();
+
+  if (type_of(pc) == KING || list->piece_no_of_board(from) == PIECE_NUMBER_NB) {
+    return false;
+  }
+
+  const Piece moved = type_of(m) == PROMOTION ? make_piece(color_of(pc), promotion_type(m)) : pc;
+  dp.dirty_num = 1;
+  dp.pieceNo[0] = list->piece_no_of_board(from);
+  dp.changed_piece[0].old_piece = list->bona_piece(dp.pieceNo[0]);
+  dp.changed_piece[0].new_piece.fw = BonaPiece(kpp_board_index[moved].fw + to);
+  dp.changed_piece[0].new_piece.fb = BonaPiece(kpp_board_index[moved].fb + Inv(to));
+
+  const Square capsq = type_of(m) == ENPASSANT ? to - pawn_push(color_of(pc)) : to;
+  if (pos.piece_on(capsq) != NO_PIECE && list->piece_no_of_board(capsq) != PIECE_NUMBER_NB) {
+    dp.dirty_num = 2;
+    dp.pieceNo[1] = list->piece_no_of_board(capsq);
+    dp.changed_piece[1].old_piece = list->bona_piece(dp.pieceNo[1]);
+    dp.changed_piece[1].new_piece.fw = BONA_PIECE_ZERO;
+    dp.changed_piece[1].new_piece.fb = BONA_PIECE_ZERO;
+  }
+  return true;
+}
+
+}  // namespace
+
+// prefetch the eval hash entry and the feature transformer columns that the
+// evaluation after the move m will read
+void prefetch_move(const Position& pos, Move m, Key key) {
+  if (!useNNUE) {
+    return;
+  }
+
+#if defined(USE_SSE2)
+  if (useEvalHash)
+    prefetch_evalhash(key);
+#endif
+
+  DirtyPiece dp;
+  if (NNUE::feature_transformer && predict_dirty_piece(pos, m, dp))
+    NNUE::feature_transformer->PrefetchChangedColumns(pos, dp);
+}
+
 // display the breakdown of the evaluation value of the current phase
 void print_eval_stat(Position& /*pos*/) {
   std::cout << "--- EVAL STAT: not implemented" << std::endl;
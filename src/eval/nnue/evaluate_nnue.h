@@ -43,22 +43,33 @@ extern std::string fileName;
 // Saved evaluation function file name
 extern std::string savedfileName;
 
+#if defined(EMBEDDED_NNUE)
+// Value of the EvalFile option that selects the network linked into the binary
+constexpr const char* kEmbeddedFileName = "<embedded>";
+
+// read evaluation function parameters from the network linked into the binary
+bool ReadEmbeddedParameters();
+#endif
+
 // Get a string that represents the structure of the evaluation function
 std::string GetArchitectureString();
 
 // read the header
+// The compressed container is accepted only if compressed is given.
 bool ReadHeader(std::istream& stream,
-    std::uint32_t* hash_value, std::string* architecture);
+    std::uint32_t* hash_value, std::string* architecture,
+    bool* compressed = nullptr);
 
 // write the header
 bool WriteHeader(std::ostream& stream,
-    std::uint32_t hash_value, const std::string& architecture);
+    std::uint32_t hash_value, const std::string& architecture,
+    bool compressed = false);
 
-// read evaluation function parameters
+// read evaluation function parameters (plain or compressed container)
 bool ReadParameters(std::istream& stream);
 
 // write evaluation function parameters
-bool WriteParameters(std::ostream& stream);
+bool WriteParameters(std::ostream& stream, bool compressed = false);
 
 }  // namespace NNUE
 
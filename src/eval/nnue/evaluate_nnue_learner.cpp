@@ -2,6 +2,8 @@
 
 #if defined(EVAL_LEARN) && defined(EVAL_NNUE)
 
+#include <atomic>
+#include <numeric>
 #include <random>
 #include <fstream>
 
@@ -24,6 +26,7 @@
 #include "trainer/trainer_affine_transform.h"
 #include "trainer/trainer_clipped_relu.h"
 #include "trainer/trainer_sum.h"
+#include "trainer/trainer_loss.h"
 
 namespace Eval {
 
@@ -49,6 +52,70 @@ std::shared_ptr<Trainer<Network>> trainer;
 // Learning rate scale
 double global_learning_rate_scale;
 
+// loss function, and the sum of the losses of the examples learned since they were last reported
+Loss loss;
+double loss_sum;
+std::uint64_t loss_count;
+
+// Gradients of the loss for the network output of a mini-batch, allocated once
+std::vector<LearnFloatType> gradients;
+
+// An example of the example cache: its features are stored one after the other
+// in cache_features, white's then black's
+struct CachedExample {
+  Learner::PackedSfenValue psv;
+  float weight;
+  std::int8_t sign;
+  std::uint32_t offset;
+  std::uint16_t num_features[2];
+};
+
+enum class CacheState { kOff, kRecording, kReplaying };
+
+// Examples of the last pass over the training data that read the files, which
+// are replayed in the following passes instead of being computed again
+CacheState cache_state = CacheState::kOff;
+std::uint64_t cache_limit;
+std::vector<CachedExample> cache_examples;
+std::vector<TrainingFeature> cache_features;
+
+// The examples of a replayed pass are visited in the order of an affine
+// permutation, so that every pass forms different mini-batches
+std::atomic<std::uint64_t> cache_next;
+std::uint64_t cache_stride;
+std::uint64_t cache_start;
+
+// Record the example in the cache, giving up the cache if it grows too big.
+// Called with examples_mutex held.
+void CacheExample(const Example& example) {
+  const std::size_t num_features = example.training_features[0].size() +
+                                   example.training_features[1].size();
+  const std::uint64_t size =
+      (cache_examples.size() + 1) * sizeof(CachedExample) +
+      (cache_features.size() + num_features) * sizeof(TrainingFeature);
+
+  if (size > cache_limit || cache_features.size() + num_features > UINT32_MAX) {
+    std::cout << "Example cache is full after " << cache_examples.size()
+              << " examples, the training data will be read again" << std::endl;
+    cache_state = CacheState::kOff;
+    std::vector<CachedExample>().swap(cache_examples);
+    std::vector<TrainingFeature>().swap(cache_features);
+    return;
+  }
+
+  CachedExample cached;
+  cached.psv = example.psv;
+  cached.weight = static_cast<float>(example.weight);
+  cached.sign = static_cast<std::int8_t>(example.sign);
+  cached.offset = static_cast<std::uint32_t>(cache_features.size());
+  for (const auto color : Colors) {
+    const auto& features = example.training_features[color];
+    cached.num_features[color] = static_cast<std::uint16_t>(features.size());
+    cache_features.insert(cache_features.end(), features.begin(), features.end());
+  }
+  cache_examples.push_back(cached);
+}
+
 // Get the learning rate scale
 double GetGlobalLearningRateScale() {
   return global_learning_rate_scale;
@@ -93,6 +160,12 @@ void SetGlobalLearningRateScale(double scale) {
   global_learning_rate_scale = scale;
 }
 
+// Select the loss function and the parameters of the elmo method
+void SetLossFunction(Learner::LossFunction function,
+                     double lambda, double lambda2, double lambda_limit) {
+  loss.SetFunction(function, lambda, lambda2, lambda_limit);
+}
+
 // Set options such as hyperparameters
 void SetOptions(const std::string& options) {
   std::vector<Message> messages;
@@ -159,9 +232,70 @@ void AddExample(Position& pos, Color rootColor,
   }
 
   std::lock_guard<std::mutex> lock(examples_mutex);
+  if (cache_state == CacheState::kRecording) {
+    CacheExample(example);
+  }
   examples.push_back(std::move(example));
 }
 
+// Set the size of the example cache in MB, 0 to disable it
+void SetExampleCacheSize(std::uint64_t size_mb) {
+  cache_limit = size_mb * 1024 * 1024;
+  StartCachingExamples();
+}
+
+// Drop the cached examples and record the ones added from now on
+void StartCachingExamples() {
+  std::lock_guard<std::mutex> lock(examples_mutex);
+  cache_state = cache_limit ? CacheState::kRecording : CacheState::kOff;
+  cache_examples.clear();
+  cache_features.clear();
+}
+
+// Start a pass over the cached examples
+bool StartReplayingExamples() {
+  std::lock_guard<std::mutex> lock(examples_mutex);
+  if (cache_state == CacheState::kOff || cache_examples.empty()) {
+    return false;
+  }
+
+  // Any stride coprime with the number of examples visits all of them once
+  const std::uint64_t size = cache_examples.size();
+  do {
+    cache_stride = rng() % size + 1;
+  } while (std::gcd(cache_stride, size) != 1);
+  cache_start = rng() % size;
+  cache_next = 0;
+  cache_state = CacheState::kReplaying;
+  return true;
+}
+
+// Add the next example of the pass over the cached examples. Returns false
+// once all of them have been added.
+bool ReplayExample() {
+  const std::uint64_t i = cache_next++;
+  if (i >= cache_examples.size()) {
+    return false;
+  }
+
+  const auto& cached =
+      cache_examples[(cache_start + i * cache_stride) % cache_examples.size()];
+  Example example;
+  example.psv = cached.psv;
+  example.weight = cached.weight;
+  example.sign = cached.sign;
+  auto features = cache_features.begin() + cached.offset;
+  for (const auto color : Colors) {
+    example.training_features[color].assign(
+        features, features + cached.num_features[color]);
+    features += cached.num_features[color];
+  }
+
+  std::lock_guard<std::mutex> lock(examples_mutex);
+  examples.push_back(std::move(example));
+  return true;
+}
+
 // update the evaluation function parameters
 void UpdateParameters(uint64_t epoch) {
   assert(batch_size > 0);
@@ -173,25 +307,30 @@ void UpdateParameters(uint64_t epoch) {
   std::lock_guard<std::mutex> lock(examples_mutex);
   std::shuffle(examples.begin(), examples.end(), rng);
   while (examples.size() >= batch_size) {
-    std::vector<Example> batch(examples.end() - batch_size, examples.end());
-    examples.resize(examples.size() - batch_size);
+    // Learn the last examples in place, they are dropped after backpropagation
+    const ExampleBatch batch(&examples[examples.size() - batch_size], batch_size);
 
     const auto network_output = trainer->Propagate(batch);
 
-    std::vector<LearnFloatType> gradients(batch.size());
-    for (std::size_t b = 0; b < batch.size(); ++b) {
-      const auto shallow = static_cast<Value>(Round<std::int32_t>(
-          batch[b].sign * network_output[b] * kPonanzaConstant));
-      const auto& psv = batch[b].psv;
-      const double gradient = batch[b].sign * Learner::calc_grad(shallow, psv);
-      gradients[b] = static_cast<LearnFloatType>(gradient * batch[b].weight);
-    }
+    gradients.resize(batch.size());
+    loss_sum += loss.Compute(batch, network_output, gradients.data());
+    loss_count += batch.size();
 
     trainer->Backpropagate(gradients.data(), learning_rate);
+    examples.resize(examples.size() - batch_size);
   }
   SendMessages({{"quantize_parameters"}});
 }
 
+// Get the sum of the losses of the examples learned since the last call and their number
+void TakeTrainingLoss(double* loss_sum_out, std::uint64_t* count_out) {
+  std::lock_guard<std::mutex> lock(examples_mutex);
+  *loss_sum_out = loss_sum;
+  *count_out = loss_count;
+  loss_sum = 0.0;
+  loss_count = 0;
+}
+
 // Check if there are any problems with learning
 void CheckHealth() {
   SendMessages({{"check_health"}});
@@ -215,7 +354,7 @@ void save_eval(std::string dir_name) {
 
   const std::string file_name = Path::Combine(eval_dir, NNUE::savedfileName);
   std::ofstream stream(file_name, std::ios::binary);
-  const bool result = NNUE::WriteParameters(stream);
+  const bool result = NNUE::WriteParameters(stream, Options["EvalSaveCompressed"]);
   assert(result);
 
   std::cout << "save_eval() finished. folder = " << eval_dir << std::endl;
@@ -31,9 +31,30 @@ void RestoreParameters(const std::string& dir_name);
 void AddExample(Position& pos, Color rootColor,
                 const Learner::PackedSfenValue& psv, double weight);
 
+// Set the size of the example cache in MB, 0 to disable it
+void SetExampleCacheSize(std::uint64_t size_mb);
+
+// Drop the cached examples and record the ones added from now on
+void StartCachingExamples();
+
+// Start a pass over the cached examples. Returns false if the cache is
+// disabled or could not hold all the examples of the last recorded pass.
+bool StartReplayingExamples();
+
+// Add the next example of the pass over the cached examples. Returns false
+// once all of them have been added.
+bool ReplayExample();
+
+// Select the loss function and the parameters of the elmo method
+void SetLossFunction(Learner::LossFunction function,
+                     double lambda, double lambda2, double lambda_limit);
+
 // update the evaluation function parameters
 void UpdateParameters(uint64_t epoch);
 
+// Get the sum of the losses of the examples learned since the last call and their number
+void TakeTrainingLoss(double* loss_sum, std::uint64_t* count);
+
 // Check if there are any problems with learning
 void CheckHealth();
 
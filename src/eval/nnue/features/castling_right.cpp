@@ -37,9 +37,15 @@ namespace Eval {
 
       // Get a list of indices whose values ​​have changed from the previous one in the feature quantity
       void CastlingRight::AppendChangedIndices(
-        const Position& pos, Color perspective,
+        const Position& pos, const DirtyPiece& dp, Color perspective,
         IndexList* removed, IndexList* added) {
 
+        // The castling rights are not part of dp, so only the change made by the
+        // last move is known, not the one of a move that is yet to be made.
+        if (&dp != &pos.state()->dirtyPiece) {
+          return;
+        }
+
         int previous_castling_rights = pos.state()->previous->castlingRights;
         int current_castling_rights = pos.state()->castlingRights;
         int relative_previous_castling_rights;
@@ -32,7 +32,7 @@ namespace Eval {
 
       // Get a list of indices whose values ??have changed from the previous one in the feature quantity
       void EnPassant::AppendChangedIndices(
-        const Position& pos, Color perspective,
+        const Position& pos, const DirtyPiece& dp, Color perspective,
         IndexList* removed, IndexList* added) {
         // Not implemented.
         assert(false);
@@ -28,13 +28,16 @@ namespace Eval {
         // Timing of full calculation instead of difference calculation
         static constexpr TriggerEvent kRefreshTrigger = TriggerEvent::kAnyPieceMoved;
 
+        // Whether the feature can ever be active in a legal position
+        static constexpr bool IsPossibleIndex(IndexType /*index*/) { return true; }
+
         // Get a list of indices with a value of 1 among the features
         static void AppendActiveIndices(const Position& pos, Color perspective,
           IndexList* active);
 
         // Get a list of indices whose values ??have changed from the previous one in the feature quantity
-        static void AppendChangedIndices(const Position& pos, Color perspective,
-          IndexList* removed, IndexList* added);
+        static void AppendChangedIndices(const Position& pos, const DirtyPiece& dp,
+          Color perspective, IndexList* removed, IndexList* added);
       };
 
     }  // namespace Features
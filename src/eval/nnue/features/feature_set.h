@@ -82,7 +82,16 @@ class FeatureSetBase {
   static void AppendChangedIndices(
       const PositionType& pos, TriggerEvent trigger,
       IndexListType removed[2], IndexListType added[2], bool reset[2]) {
-    const auto& dp = pos.state()->dirtyPiece;
+    AppendChangedIndices(pos, pos.state()->dirtyPiece, trigger,
+                         removed, added, reset);
+  }
+
+  // Same as above for the pieces moved as described by dp, which may also be
+  // a move that has not been made yet
+  template <typename PositionType, typename IndexListType>
+  static void AppendChangedIndices(
+      const PositionType& pos, const DirtyPiece& dp, TriggerEvent trigger,
+      IndexListType removed[2], IndexListType added[2], bool reset[2]) {
     if (dp.dirty_num == 0) return;
 
     for (const auto perspective :Colors) {
@@ -113,7 +122,7 @@ class FeatureSetBase {
             pos, trigger, perspective, &added[perspective]);
       } else {
         Derived::CollectChangedIndices(
-            pos, trigger, perspective,
+            pos, dp, trigger, perspective,
             &removed[perspective], &added[perspective]);
       }
     }
@@ -150,6 +159,12 @@ class FeatureSet<FirstFeatureType, RemainingFeatureTypes...> :
     return std::string(Head::kName) + "+" + Tail::GetName();
   }
 
+  // Whether the feature can ever be active in a legal position
+  static constexpr bool IsPossibleIndex(IndexType index) {
+    return index < Tail::kDimensions ? Tail::IsPossibleIndex(index) :
+        Head::IsPossibleIndex(index - Tail::kDimensions);
+  }
+
  private:
   // Get a list of indices with a value of 1 among the features
   template <typename IndexListType>
@@ -169,13 +184,14 @@ class FeatureSet<FirstFeatureType, RemainingFeatureTypes...> :
   // Get a list of indices whose values ​​have changed from the previous one in the feature quantity
   template <typename IndexListType>
   static void CollectChangedIndices(
-      const Position& pos, const TriggerEvent trigger, const Color perspective,
+      const Position& pos, const DirtyPiece& dp, const TriggerEvent trigger,
+      const Color perspective,
       IndexListType* const removed, IndexListType* const added) {
-    Tail::CollectChangedIndices(pos, trigger, perspective, removed, added);
+    Tail::CollectChangedIndices(pos, dp, trigger, perspective, removed, added);
     if (Head::kRefreshTrigger == trigger) {
       const auto start_removed = removed->size();
       const auto start_added = added->size();
-      Head::AppendChangedIndices(pos, perspective, removed, added);
+      Head::AppendChangedIndices(pos, dp, perspective, removed, added);
       for (auto i = start_removed; i < removed->size(); ++i) {
         (*removed)[i] += Tail::kDimensions;
       }
@@ -213,6 +229,11 @@ class FeatureSet<FeatureType> : public FeatureSetBase<FeatureSet<FeatureType>> {
     return FeatureType::kName;
   }
 
+  // Whether the feature can ever be active in a legal position
+  static constexpr bool IsPossibleIndex(IndexType index) {
+    return FeatureType::IsPossibleIndex(index);
+  }
+
  private:
   // Get a list of indices with a value of 1 among the features
   static void CollectActiveIndices(
@@ -225,10 +246,11 @@ class FeatureSet<FeatureType> : public FeatureSetBase<FeatureSet<FeatureType>> {
 
   // Get a list of indices whose values ​​have changed from the previous one in the feature quantity
   static void CollectChangedIndices(
-      const Position& pos, const TriggerEvent trigger, const Color perspective,
+      const Position& pos, const DirtyPiece& dp, const TriggerEvent trigger,
+      const Color perspective,
       IndexList* const removed, IndexList* const added) {
     if (FeatureType::kRefreshTrigger == trigger) {
-      FeatureType::AppendChangedIndices(pos, perspective, removed, added);
+      FeatureType::AppendChangedIndices(pos, dp, perspective, removed, added);
     }
   }
 
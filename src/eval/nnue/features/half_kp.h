@@ -34,12 +34,26 @@ class HalfKP {
       (AssociatedKing == Side::kFriend) ?
       TriggerEvent::kFriendKingMoved : TriggerEvent::kEnemyKingMoved;
 
+  // Whether the feature can ever be active in a legal position.
+  // BONA_PIECE_ZERO, pawns on the first or last rank and pieces standing on
+  // the square of the ball itself never occur.
+  static constexpr bool IsPossibleIndex(IndexType index) {
+    const IndexType sq_k = index / static_cast<IndexType>(fe_end);
+    const IndexType p = index % static_cast<IndexType>(fe_end);
+    if (p < static_cast<IndexType>(fe_hand_end)) return false;
+    const IndexType sq = (p - fe_hand_end) % SQUARE_NB;
+    if (p < static_cast<IndexType>(f_knight) &&
+        (sq / FILE_NB == RANK_1 || sq / FILE_NB == RANK_8)) return false;
+    return sq != sq_k;
+  }
+
   // Get a list of indices with a value of 1 among the features
   static void AppendActiveIndices(const Position& pos, Color perspective,
                                   IndexList* active);
 
   // Get a list of indices whose values ​​have changed from the previous one in the feature quantity
-  static void AppendChangedIndices(const Position& pos, Color perspective,
+  static void AppendChangedIndices(const Position& pos, const DirtyPiece& dp,
+                                   Color perspective,
                                    IndexList* removed, IndexList* added);
 
   // Find the index of the feature quantity from the ball position and BonaPiece
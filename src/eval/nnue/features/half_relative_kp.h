@@ -40,12 +40,16 @@ class HalfRelativeKP {
       (AssociatedKing == Side::kFriend) ?
       TriggerEvent::kFriendKingMoved : TriggerEvent::kEnemyKingMoved;
 
+  // Whether the feature can ever be active in a legal position
+  static constexpr bool IsPossibleIndex(IndexType /*index*/) { return true; }
+
   // Get a list of indices with a value of 1 among the features
   static void AppendActiveIndices(const Position& pos, Color perspective,
                                   IndexList* active);
 
   // Get a list of indices whose values ​​have changed from the previous one in the feature quantity
-  static void AppendChangedIndices(const Position& pos, Color perspective,
+  static void AppendChangedIndices(const Position& pos, const DirtyPiece& dp,
+                                   Color perspective,
                                    IndexList* removed, IndexList* added);
 
   // Find the index of the feature quantity from the ball position and BonaPiece
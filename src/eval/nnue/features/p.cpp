@@ -29,9 +29,8 @@ void P::AppendActiveIndices(
 
 // Get a list of indices whose values ​​have changed from the previous one in the feature quantity
 void P::AppendChangedIndices(
-    const Position& pos, Color perspective,
+    const Position& pos, const DirtyPiece& dp, Color perspective,
     IndexList* removed, IndexList* added) {
-  const auto& dp = pos.state()->dirtyPiece;
   for (int i = 0; i < dp.dirty_num; ++i) {
     if (dp.pieceNo[i] >= PIECE_NUMBER_KING) continue;
     if (dp.changed_piece[i].old_piece.from[perspective] != Eval::BONA_PIECE_ZERO) {
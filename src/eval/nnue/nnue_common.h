@@ -22,6 +22,9 @@ namespace NNUE {
 // A constant that represents the version of the evaluation function file
 constexpr std::uint32_t kVersion = 0x7AF32F16u;
 
+// Version of the file whose feature transformer weights are compressed
+constexpr std::uint32_t kCompressedVersion = 0x7AF32F17u;
+
 // Constant used in evaluation value calculation
 constexpr int FV_SCALE = 16;
 constexpr int kWeightScaleBits = 6;
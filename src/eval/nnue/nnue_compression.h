@@ -0,0 +1,157 @@
+﻿// Compressed container for the parameters of the NNUE evaluation function
+
+#ifndef _NNUE_COMPRESSION_H_
+#define _NNUE_COMPRESSION_H_
+
+#if defined(EVAL_NNUE)
+
+#include "nnue_common.h"
+#include "../../task_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace Eval {
+
+namespace NNUE {
+
+namespace Compression {
+
+// Values are stored in independently decodable blocks of this many values,
+// so that they can be decompressed in parallel
+constexpr std::size_t kBlockSize = 1 << 16;
+
+// A value takes at most 3 bytes: a varint of up to 16 bits, or a zero and the
+// varint of a zero run, which is never longer than the values it stands for
+constexpr std::size_t kMaxValueBytes = 3;
+
+// Map small negative and positive values to small unsigned values
+inline std::uint32_t ZigZag(std::int16_t value) {
+  return (static_cast<std::uint32_t>(value) << 1) ^
+      static_cast<std::uint32_t>(value >> 15);
+}
+
+inline std::int16_t UnZigZag(std::uint32_t code) {
+  return static_cast<std::int16_t>((code >> 1) ^ (0u - (code & 1)));
+}
+
+inline void PutVarint(std::uint32_t value, std::string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+inline bool GetVarint(const char** p, const char* end, std::uint32_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 32 && *p < end; shift += 7) {
+    const auto byte = static_cast<std::uint8_t>(*(*p)++);
+    *value |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+// Encode one block: every value is a zigzag varint, and a zero is followed by
+// the number of further zeros, so that unobserved columns cost almost nothing
+inline void EncodeBlock(const std::int16_t* values, std::size_t size,
+                        std::string* out) {
+  for (std::size_t i = 0; i < size; ) {
+    PutVarint(ZigZag(values[i]), out);
+    if (values[i++] != 0) continue;
+    std::size_t run = 0;
+    while (i < size && values[i] == 0) { ++run; ++i; }
+    PutVarint(static_cast<std::uint32_t>(run), out);
+  }
+}
+
+inline bool DecodeBlock(const char* p, const char* end,
+                        std::int16_t* values, std::size_t size) {
+  for (std::size_t i = 0; i < size; ) {
+    std::uint32_t code;
+    if (!GetVarint(&p, end, &code)) return false;
+    values[i++] = UnZigZag(code);
+    if (code != 0) continue;
+    std::uint32_t run;
+    if (!GetVarint(&p, end, &run) || run > size - i) return false;
+    std::fill_n(values + i, run, std::int16_t(0));
+    i += run;
+  }
+  return p == end;
+}
+
+inline std::size_t NumBlocks(std::size_t count) {
+  return (count + kBlockSize - 1) / kBlockSize;
+}
+
+// Write values as: number of blocks, size of every block, block data
+inline bool WriteValues(std::ostream& stream,
+                        const std::int16_t* values, std::size_t count) {
+  const auto num_blocks = static_cast<std::uint32_t>(NumBlocks(count));
+  std::vector<std::string> blocks(num_blocks);
+  for (std::size_t b = 0; b < num_blocks; ++b) {
+    const std::size_t begin = b * kBlockSize;
+    EncodeBlock(values + begin, std::min(kBlockSize, count - begin), &blocks[b]);
+  }
+  stream.write(reinterpret_cast<const char*>(&num_blocks), sizeof(num_blocks));
+  for (const auto& block : blocks) {
+    const auto size = static_cast<std::uint32_t>(block.size());
+    stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  }
+  for (const auto& block : blocks) {
+    stream.write(block.data(), block.size());
+  }
+  return !stream.fail();
+}
+
+// Read values written by WriteValues(). The compressed data is read in one go
+// and the blocks are then decoded straight into values on the task pool.
+inline bool ReadValues(std::istream& stream,
+                       std::int16_t* values, std::size_t count) {
+  std::uint32_t num_blocks;
+  stream.read(reinterpret_cast<char*>(&num_blocks), sizeof(num_blocks));
+  if (!stream || num_blocks != NumBlocks(count)) return false;
+
+  std::vector<std::uint32_t> sizes(num_blocks);
+  stream.read(reinterpret_cast<char*>(sizes.data()),
+              num_blocks * sizeof(std::uint32_t));
+  if (!stream) return false;
+
+  // The sizes come from the file: reject the ones that cannot belong to a
+  // block of the expected number of values before allocating for them
+  std::vector<std::size_t> offsets(num_blocks + 1, 0);
+  for (std::size_t b = 0; b < num_blocks; ++b) {
+    const std::size_t remaining = count - b * kBlockSize;
+    if (sizes[b] > std::min(kBlockSize, remaining) * kMaxValueBytes) return false;
+    offsets[b + 1] = offsets[b] + sizes[b];
+  }
+  std::vector<char> data(offsets[num_blocks]);
+  stream.read(data.data(), data.size());
+  if (!stream) return false;
+
+  std::atomic<bool> success(true);
+  Tasks.parallel_for(0, num_blocks, 1, [&](std::size_t first, std::size_t last) {
+    for (std::size_t b = first; b < last; ++b) {
+      const std::size_t begin = b * kBlockSize;
+      if (!DecodeBlock(data.data() + offsets[b], data.data() + offsets[b + 1],
+                       values + begin, std::min(kBlockSize, count - begin))) {
+        success = false;
+      }
+    }
+  });
+  return success;
+}
+
+}  // namespace Compression
+
+}  // namespace NNUE
+
+}  // namespace Eval
+
+#endif  // defined(EVAL_NNUE)
+
+#endif
@@ -7,14 +7,31 @@
 
 #include "nnue_common.h"
 #include "nnue_architecture.h"
+#include "nnue_compression.h"
 #include "features/index_list.h"
 
+#include <algorithm> // std::all_of()
 #include <cstring> // std::memset()
 
+#if defined(USE_COMPACT_FEATURES) && defined(EVAL_LEARN)
+#error "USE_COMPACT_FEATURES can not be used together with EVAL_LEARN"
+#endif
+
 namespace Eval {
 
 namespace NNUE {
 
+#if defined(USE_COMPACT_FEATURES)
+// number of input features that can be active in a legal position
+constexpr IndexType CountPossibleFeatures() {
+  IndexType count = 0;
+  for (IndexType i = 0; i < RawFeatures::kDimensions; ++i) {
+    count += RawFeatures::IsPossibleIndex(i);
+  }
+  return count;
+}
+#endif
+
 // Input feature converter
 class FeatureTransformer {
  private:
@@ -33,6 +50,16 @@ class FeatureTransformer {
   static constexpr std::size_t kBufferSize =
       kOutputDimensions * sizeof(OutputType);
 
+  // number of weight columns held in memory
+#if defined(USE_COMPACT_FEATURES)
+  // Only features that can be active and whose weights are not all zero get
+  // their own column. Everything else shares column 0, which is all zero.
+  static constexpr IndexType kNumColumns = CountPossibleFeatures() + 1;
+  static_assert(kNumColumns <= (1 << 16), "column index must fit in 16 bits");
+#else
+  static constexpr IndexType kNumColumns = kInputDimensions;
+#endif
+
   // Hash value embedded in the evaluation function file
   static constexpr std::uint32_t GetHashValue() {
     return RawFeatures::kHashValue ^ kOutputDimensions;
@@ -49,8 +76,18 @@ class FeatureTransformer {
   bool ReadParameters(std::istream& stream) {
     stream.read(reinterpret_cast<char*>(biases_),
                 kHalfDimensions * sizeof(BiasType));
+#if defined(USE_COMPACT_FEATURES)
+    // The file always holds the dense layout. Pack it while reading.
+    ClearColumns();
+    WeightType column[kHalfDimensions];
+    for (IndexType i = 0; i < kInputDimensions; ++i) {
+      stream.read(reinterpret_cast<char*>(column), sizeof(column));
+      PackColumn(i, column);
+    }
+#else
     stream.read(reinterpret_cast<char*>(weights_),
                 kHalfDimensions * kInputDimensions * sizeof(WeightType));
+#endif
     return !stream.fail();
   }
 
@@ -58,11 +95,78 @@ class FeatureTransformer {
   bool WriteParameters(std::ostream& stream) const {
     stream.write(reinterpret_cast<const char*>(biases_),
                  kHalfDimensions * sizeof(BiasType));
+#if defined(USE_COMPACT_FEATURES)
+    // Expand back to the dense layout so that the file stays compatible
+    for (IndexType i = 0; i < kInputDimensions; ++i) {
+      stream.write(reinterpret_cast<const char*>(&weights_[ColumnOffset(i)]),
+                   kHalfDimensions * sizeof(WeightType));
+    }
+#else
     stream.write(reinterpret_cast<const char*>(weights_),
                  kHalfDimensions * kInputDimensions * sizeof(WeightType));
+#endif
     return !stream.fail();
   }
 
+  // read parameters from the compressed container
+  bool ReadCompressedParameters(std::istream& stream) {
+    stream.read(reinterpret_cast<char*>(biases_),
+                kHalfDimensions * sizeof(BiasType));
+    if (!stream) return false;
+#if defined(USE_COMPACT_FEATURES)
+    std::vector<WeightType> dense(kHalfDimensions * kInputDimensions);
+    if (!Compression::ReadValues(stream, dense.data(), dense.size())) {
+      return false;
+    }
+    ClearColumns();
+    for (IndexType i = 0; i < kInputDimensions; ++i) {
+      PackColumn(i, &dense[kHalfDimensions * i]);
+    }
+    return true;
+#else
+    return Compression::ReadValues(
+        stream, weights_, kHalfDimensions * kInputDimensions);
+#endif
+  }
+
+  // write parameters to the compressed container
+  bool WriteCompressedParameters(std::ostream& stream) const {
+    stream.write(reinterpret_cast<const char*>(biases_),
+                 kHalfDimensions * sizeof(BiasType));
+#if defined(USE_COMPACT_FEATURES)
+    std::vector<WeightType> dense(kHalfDimensions * kInputDimensions);
+    for (IndexType i = 0; i < kInputDimensions; ++i) {
+      std::memcpy(&dense[kHalfDimensions * i], &weights_[ColumnOffset(i)],
+                  kHalfDimensions * sizeof(WeightType));
+    }
+    return Compression::WriteValues(stream, dense.data(), dense.size());
+#else
+    return Compression::WriteValues(
+        stream, weights_, kHalfDimensions * kInputDimensions);
+#endif
+  }
+
+  // Whether the parameters are laid out in memory exactly as in the file,
+  // so that a network image can be used in place
+  static constexpr bool IsLayoutSameAsFile() {
+#if defined(USE_COMPACT_FEATURES)
+    return false;
+#else
+    return sizeof(FeatureTransformer) ==
+        kHalfDimensions * sizeof(BiasType) +
+        kHalfDimensions * kInputDimensions * sizeof(WeightType);
+#endif
+  }
+
+  // number of weight columns actually filled
+  IndexType GetNumUsedColumns() const {
+#if defined(USE_COMPACT_FEATURES)
+    return num_used_columns_;
+#else
+    return kInputDimensions;
+#endif
+  }
+
   // proceed with the difference calculation if possible
   bool UpdateAccumulatorIfPossible(const Position& pos) const {
     const auto now = pos.state();
@@ -77,9 +181,32 @@ class FeatureTransformer {
     return false;
   }
 
-  // convert input features
-  void Transform(const Position& pos, OutputType* output, bool refresh) const {
-    if (refresh || !UpdateAccumulatorIfPossible(pos)) {
+  // prefetch the weight columns that the difference calculation of the pieces
+  // moved as described by dp will touch
+  void PrefetchChangedColumns(const Position& pos, const DirtyPiece& dp) const {
+    for (IndexType i = 0; i < kRefreshTriggers.size(); ++i) {
+      Features::IndexList removed_indices[2], added_indices[2];
+      bool reset[2] = {false, false};
+      RawFeatures::AppendChangedIndices(pos, dp, kRefreshTriggers[i],
+                                        removed_indices, added_indices, reset);
+      for (const auto perspective : Colors) {
+        // A full refresh reads all active columns anyway, so don't flood the
+        // prefetcher with them here.
+        if (reset[perspective]) continue;
+        for (const auto index : removed_indices[perspective]) {
+          PrefetchColumn(index);
+        }
+        for (const auto index : added_indices[perspective]) {
+          PrefetchColumn(index);
+        }
+      }
+    }
+  }
+
+  // convert input features, returns true if the accumulator was computed from scratch
+  bool Transform(const Position& pos, OutputType* output, bool refresh) const {
+    const bool refreshed = refresh || !UpdateAccumulatorIfPossible(pos);
+    if (refreshed) {
       RefreshAccumulator(pos);
     }
     const auto& accumulation = pos.state()->accumulator.accumulation;
@@ -181,9 +308,30 @@ class FeatureTransformer {
       }
 #endif
     }
+    return refreshed;
   }
 
  private:
+
+  // offset of the weight column of an input feature
+  IndexType ColumnOffset(IndexType index) const {
+#if defined(USE_COMPACT_FEATURES)
+    return kHalfDimensions * column_index_[index];
+#else
+    return kHalfDimensions * index;
+#endif
+  }
+
+  // issue a prefetch for every cache line of one weight column
+  void PrefetchColumn(IndexType index) const {
+    constexpr IndexType kColumnBytes = kHalfDimensions * sizeof(WeightType);
+    const auto column = reinterpret_cast<const char*>(
+        &weights_[ColumnOffset(index)]);
+    for (IndexType j = 0; j < kColumnBytes; j += kCacheLineSize) {
+      prefetch(const_cast<char*>(column + j));
+    }
+  }
+
   // Calculate cumulative value without using difference calculation
   void RefreshAccumulator(const Position& pos) const {
     auto& accumulator = pos.state()->accumulator;
@@ -200,7 +348,7 @@ class FeatureTransformer {
                       kHalfDimensions * sizeof(BiasType));
         }
         for (const auto index : active_indices[perspective]) {
-          const IndexType offset = kHalfDimensions * index;
+          const IndexType offset = ColumnOffset(index);
 #if defined(USE_AVX2)
           auto accumulation = reinterpret_cast<__m256i*>(
               &accumulator.accumulation[perspective][i][0]);
@@ -278,7 +426,7 @@ class FeatureTransformer {
                       prev_accumulator.accumulation[perspective][i],
                       kHalfDimensions * sizeof(BiasType));
           for (const auto index : removed_indices[perspective]) {
-            const IndexType offset = kHalfDimensions * index;
+            const IndexType offset = ColumnOffset(index);
 #if defined(USE_AVX2)
             auto column = reinterpret_cast<const __m256i*>(&weights_[offset]);
             for (IndexType j = 0; j < kNumChunks; ++j) {
@@ -304,7 +452,7 @@ class FeatureTransformer {
         }
         {// Difference calculation for features that changed from 0 to 1
           for (const auto index : added_indices[perspective]) {
-            const IndexType offset = kHalfDimensions * index;
+            const IndexType offset = ColumnOffset(index);
 #if defined(USE_AVX2)
             auto column = reinterpret_cast<const __m256i*>(&weights_[offset]);
             for (IndexType j = 0; j < kNumChunks; ++j) {
@@ -339,13 +487,39 @@ class FeatureTransformer {
   using BiasType = std::int16_t;
   using WeightType = std::int16_t;
 
+#if defined(USE_COMPACT_FEATURES)
+  // start packing columns: only the shared zero column is in use
+  void ClearColumns() {
+    std::memset(weights_, 0, kHalfDimensions * sizeof(WeightType));
+    num_used_columns_ = 1;
+  }
+
+  // store the dense column of input feature i unless it can be shared
+  void PackColumn(IndexType i, const WeightType* column) {
+    if (!RawFeatures::IsPossibleIndex(i) ||
+        std::all_of(column, column + kHalfDimensions,
+                    [](WeightType w) { return w == 0; })) {
+      column_index_[i] = 0;
+      return;
+    }
+    column_index_[i] = static_cast<std::uint16_t>(num_used_columns_);
+    std::memcpy(&weights_[kHalfDimensions * num_used_columns_++], column,
+                kHalfDimensions * sizeof(WeightType));
+  }
+#endif
+
   // Make the learning class a friend
   friend class Trainer<FeatureTransformer>;
 
   // parameter
   alignas(kCacheLineSize) BiasType biases_[kHalfDimensions];
   alignas(kCacheLineSize)
-      WeightType weights_[kHalfDimensions * kInputDimensions];
+      WeightType weights_[kHalfDimensions * kNumColumns];
+#if defined(USE_COMPACT_FEATURES)
+  // input feature -> weight column
+  std::uint16_t column_index_[kInputDimensions];
+  IndexType num_used_columns_;
+#endif
 };
 
 }  // namespace NNUE
@@ -154,15 +154,19 @@ void PrintInfo(std::istream& stream) {
 
     std::uint32_t hash_value;
     std::string architecture;
+    bool compressed;
     const bool success = [&]() {
       std::ifstream file_stream(file_name, std::ios::binary);
       if (!file_stream) return false;
-      if (!ReadHeader(file_stream, &hash_value, &architecture)) return false;
+      if (!ReadHeader(file_stream, &hash_value, &architecture, &compressed)) return false;
       return true;
     }();
 
     std::cout << file_name << ": ";
     if (success) {
+      if (compressed) {
+        std::cout << "(compressed) ";
+      }
       if (hash_value == kHashValue) {
         std::cout << "matches with this binary";
         if (architecture != GetArchitectureString()) {
@@ -178,6 +182,33 @@ void PrintInfo(std::istream& stream) {
   }
 }
 
+// Convert an evaluation function file to the compressed container.
+// The converted network stays loaded. It is read into the network in use, so
+// the search must be over, and a file that fails to read is replaced by the
+// network of the EvalFile option again.
+void Compress(std::istream& stream) {
+  std::string input_file_name, output_file_name;
+  stream >> input_file_name >> output_file_name;
+
+  Threads.main()->wait_for_search_finished();
+
+  std::ifstream input_stream(input_file_name, std::ios::binary);
+  if (!ReadParameters(input_stream)) {
+    std::cout << "failed to read " << input_file_name << ", reloading "
+              << std::string(Options["EvalFile"]) << std::endl;
+    UCI::load_eval_finished = false;
+    init_nnue();
+    return;
+  }
+  std::ofstream output_stream(output_file_name, std::ios::binary);
+  if (!WriteParameters(output_stream, true)) {
+    std::cout << "failed to write " << output_file_name << std::endl;
+    return;
+  }
+  std::cout << input_file_name << " -> " << output_file_name << " ("
+            << output_stream.tellp() << " bytes)" << std::endl;
+}
+
 }  // namespace
 
 // USI extended command for NNUE evaluation function
@@ -189,10 +220,13 @@ void TestCommand(Position& pos, std::istream& stream) {
     TestFeatures(pos);
   } else if (sub_command == "info") {
     PrintInfo(stream);
+  } else if (sub_command == "compress") {
+    Compress(stream);
   } else {
     std::cout << "usage:" << std::endl;
     std::cout << " test nnue test_features" << std::endl;
     std::cout << " test nnue info [path/to/" << fileName << "...]" << std::endl;
+    std::cout << " test nnue compress path/to/input path/to/output" << std::endl;
   }
 }
 
@@ -68,6 +68,24 @@ struct Example {
   double weight;
 };
 
+// A mini-batch, a view of consecutive examples. The examples are owned by
+// the caller and must stay in place until the batch has been backpropagated.
+class ExampleBatch {
+ public:
+  ExampleBatch() : first_(nullptr), size_(0) {}
+  ExampleBatch(const Example* first, std::size_t size) :
+      first_(first), size_(size) {}
+
+  std::size_t size() const { return size_; }
+  const Example& operator[](std::size_t i) const { return first_[i]; }
+  const Example* begin() const { return first_; }
+  const Example* end() const { return first_ + size_; }
+
+ private:
+  const Example* first_;
+  std::size_t size_;
+};
+
 // Message used for setting hyperparameters
 struct Message {
   Message(const std::string& name, const std::string& value = ""):
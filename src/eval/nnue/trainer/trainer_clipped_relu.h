@@ -31,6 +31,9 @@ class Trainer<Layers::ClippedReLU<PreviousLayer>> {
   // Set options such as hyperparameters
   void SendMessage(Message* message) {
     previous_layer_trainer_->SendMessage(message);
+    if (ReceiveMessage("health_sample_interval", message)) {
+      health_sample_interval_ = std::max<std::uint64_t>(std::stoull(message->value), 1);
+    }
     if (ReceiveMessage("check_health", message)) {
       CheckHealth();
     }
@@ -43,20 +46,25 @@ class Trainer<Layers::ClippedReLU<PreviousLayer>> {
   }
 
   // forward propagation
-  const LearnFloatType* Propagate(const std::vector<Example>& batch) {
+  const LearnFloatType* Propagate(const ExampleBatch& batch) {
     if (output_.size() < kOutputDimensions * batch.size()) {
       output_.resize(kOutputDimensions * batch.size());
       gradients_.resize(kInputDimensions * batch.size());
     }
     const auto input = previous_layer_trainer_->Propagate(batch);
     batch_size_ = static_cast<IndexType>(batch.size());
-    for (IndexType b = 0; b < batch_size_; ++b) {
-      const IndexType batch_offset = kOutputDimensions * b;
-      for (IndexType i = 0; i < kOutputDimensions; ++i) {
-        const IndexType index = batch_offset + i;
-        output_[index] = std::max(+kZero, std::min(+kOne, input[index]));
-        min_activations_[i] = std::min(min_activations_[i], output_[index]);
-        max_activations_[i] = std::max(max_activations_[i], output_[index]);
+    for (IndexType index = 0; index < kOutputDimensions * batch_size_; ++index) {
+      output_[index] = std::max(+kZero, std::min(+kOne, input[index]));
+    }
+    // health check statistics, from one mini-batch in health_sample_interval_
+    if (++num_batches_ % health_sample_interval_ == 0) {
+      for (IndexType b = 0; b < batch_size_; ++b) {
+        const IndexType batch_offset = kOutputDimensions * b;
+        for (IndexType i = 0; i < kOutputDimensions; ++i) {
+          const IndexType index = batch_offset + i;
+          min_activations_[i] = std::min(min_activations_[i], output_[index]);
+          max_activations_[i] = std::max(max_activations_[i], output_[index]);
+        }
       }
     }
     return output_.data();
@@ -82,7 +90,9 @@ class Trainer<Layers::ClippedReLU<PreviousLayer>> {
       batch_size_(0),
       previous_layer_trainer_(Trainer<PreviousLayer>::Create(
           &target_layer->previous_layer_, feature_transformer)),
-      target_layer_(target_layer) {
+      target_layer_(target_layer),
+      health_sample_interval_(1),
+      num_batches_(0) {
     std::fill(std::begin(min_activations_), std::end(min_activations_),
               std::numeric_limits<LearnFloatType>::max());
     std::fill(std::begin(max_activations_), std::end(max_activations_),
@@ -128,6 +138,11 @@ class Trainer<Layers::ClippedReLU<PreviousLayer>> {
   // buffer for back propagation
   std::vector<LearnFloatType> gradients_;
 
+  // The health check statistics are gathered from one mini-batch in
+  // health_sample_interval_
+  std::uint64_t health_sample_interval_;
+  std::uint64_t num_batches_;
+
   // Health check statistics
   LearnFloatType min_activations_[kOutputDimensions];
   LearnFloatType max_activations_[kOutputDimensions];
@@ -6,20 +6,17 @@
 #if defined(EVAL_LEARN) && defined(EVAL_NNUE)
 
 #include "../../../learn/learn.h"
+#include "../../../task_pool.h"
 #include "../nnue_feature_transformer.h"
 #include "trainer.h"
+#include "trainer_simd.h"
 #include "features/factorizer_feature_set.h"
 
 #include <array>
-#include <bitset>
 #include <numeric>
 #include <random>
 #include <set>
 
-#if defined(_OPENMP)
-#include <omp.h>
-#endif
-
 namespace Eval {
 
 namespace NNUE {
@@ -60,6 +57,9 @@ class Trainer<FeatureTransformer> {
     if (ReceiveMessage("clear_unobserved_feature_weights", message)) {
       ClearUnobservedFeatureWeights();
     }
+    if (ReceiveMessage("health_sample_interval", message)) {
+      health_sample_interval_ = std::max<std::uint64_t>(std::stoull(message->value), 1);
+    }
     if (ReceiveMessage("check_health", message)) {
       CheckHealth();
     }
@@ -82,52 +82,53 @@ class Trainer<FeatureTransformer> {
   }
 
   // forward propagation
-  const LearnFloatType* Propagate(const std::vector<Example>& batch) {
+  const LearnFloatType* Propagate(const ExampleBatch& batch) {
     if (output_.size() < kOutputDimensions * batch.size()) {
       output_.resize(kOutputDimensions * batch.size());
       gradients_.resize(kOutputDimensions * batch.size());
     }
-    batch_ = &batch;
-    // affine transform
-#pragma omp parallel for
-    for (IndexType b = 0; b < batch.size(); ++b) {
-      const IndexType batch_offset = kOutputDimensions * b;
-      for (IndexType c = 0; c < 2; ++c) {
-        const IndexType output_offset = batch_offset + kHalfDimensions * c;
-#if defined(USE_BLAS)
-        cblas_scopy(kHalfDimensions, biases_, 1, &output_[output_offset], 1);
-        for (const auto& feature : batch[b].training_features[c]) {
-          const IndexType weights_offset = kHalfDimensions * feature.GetIndex();
-          cblas_saxpy(kHalfDimensions, (float)feature.GetCount(),
-                      &weights_[weights_offset], 1, &output_[output_offset], 1);
-        }
-#else
-        for (IndexType i = 0; i < kHalfDimensions; ++i) {
-          output_[output_offset + i] = biases_[i];
-        }
-        for (const auto& feature : batch[b].training_features[c]) {
-          const IndexType weights_offset = kHalfDimensions * feature.GetIndex();
-          for (IndexType i = 0; i < kHalfDimensions; ++i) {
-            output_[output_offset + i] +=
-                feature.GetCount() * weights_[weights_offset + i];
+    batch_ = batch;
+    // affine transform and clipped ReLU in one pass. The statistics of the
+    // health check are gathered on the way, from one mini-batch in
+    // health_sample_interval_
+    if (++num_batches_ % health_sample_interval_ != 0) {
+      Tasks.parallel_for(0, batch.size(), kBatchGrain, [&](std::size_t first, std::size_t last) {
+        for (IndexType b = first; b < last; ++b) {
+          const IndexType batch_offset = kOutputDimensions * b;
+          for (IndexType c = 0; c < 2; ++c) {
+            const IndexType output_offset = batch_offset + kHalfDimensions * c;
+            PropagateHalf<false>(batch[b].training_features[c],
+                                 &output_[output_offset], nullptr);
           }
         }
-#endif
-      }
+      });
+      return output_.data();
     }
-    // clipped ReLU
-    for (IndexType b = 0; b < batch.size(); ++b) {
-      const IndexType batch_offset = kOutputDimensions * b;
-      for (IndexType i = 0; i < kOutputDimensions; ++i) {
-        const IndexType index = batch_offset + i;
-        min_pre_activation_ = std::min(min_pre_activation_, output_[index]);
-        max_pre_activation_ = std::max(max_pre_activation_, output_[index]);
-        output_[index] = std::max(+kZero, std::min(+kOne, output_[index]));
-        const IndexType t = i % kHalfDimensions;
-        min_activations_[t] = std::min(min_activations_[t], output_[index]);
-        max_activations_[t] = std::max(max_activations_[t], output_[index]);
-      }
+    const ActivationStats stats = Tasks.reduce(
+        std::size_t(0), batch.size(), kBatchGrain, ActivationStats(),
+        [&](std::size_t first, std::size_t last) {
+          ActivationStats local;
+          for (IndexType b = first; b < last; ++b) {
+            const IndexType batch_offset = kOutputDimensions * b;
+            for (IndexType c = 0; c < 2; ++c) {
+              const IndexType output_offset = batch_offset + kHalfDimensions * c;
+              PropagateHalf<true>(batch[b].training_features[c],
+                                  &output_[output_offset], &local);
+            }
+          }
+          return local;
+        },
+        [](ActivationStats total, const ActivationStats& part) {
+          total.Merge(part);
+          return total;
+        });
+    min_pre_activation_ = std::min(min_pre_activation_, stats.min_pre_activation);
+    max_pre_activation_ = std::max(max_pre_activation_, stats.max_pre_activation);
+    for (IndexType i = 0; i < kHalfDimensions; ++i) {
+      min_activations_[i] = std::min(min_activations_[i], stats.min_activations[i]);
+      max_activations_[i] = std::max(max_activations_[i], stats.max_activations[i]);
     }
+    ++num_sampled_batches_;
     return output_.data();
   }
 
@@ -136,7 +137,7 @@ class Trainer<FeatureTransformer> {
                      LearnFloatType learning_rate) {
     const LearnFloatType local_learning_rate =
         learning_rate * learning_rate_scale_;
-    for (IndexType b = 0; b < batch_->size(); ++b) {
+    for (IndexType b = 0; b < batch_.size(); ++b) {
       const IndexType batch_offset = kOutputDimensions * b;
       for (IndexType i = 0; i < kOutputDimensions; ++i) {
         const IndexType index = batch_offset + i;
@@ -150,7 +151,7 @@ class Trainer<FeatureTransformer> {
         static_cast<LearnFloatType>(local_learning_rate / (1.0 - momentum_));
 #if defined(USE_BLAS)
     cblas_sscal(kHalfDimensions, momentum_, biases_diff_, 1);
-    for (IndexType b = 0; b < batch_->size(); ++b) {
+    for (IndexType b = 0; b < batch_.size(); ++b) {
       const IndexType batch_offset = kOutputDimensions * b;
       for (IndexType c = 0; c < 2; ++c) {
         const IndexType output_offset = batch_offset + kHalfDimensions * c;
@@ -160,36 +161,11 @@ class Trainer<FeatureTransformer> {
     }
     cblas_saxpy(kHalfDimensions, -local_learning_rate,
                 biases_diff_, 1, biases_, 1);
-#pragma omp parallel
-    {
-#if defined(_OPENMP)
-      const IndexType num_threads = omp_get_num_threads();
-      const IndexType thread_index = omp_get_thread_num();
-#endif
-      for (IndexType b = 0; b < batch_->size(); ++b) {
-        const IndexType batch_offset = kOutputDimensions * b;
-        for (IndexType c = 0; c < 2; ++c) {
-          const IndexType output_offset = batch_offset + kHalfDimensions * c;
-          for (const auto& feature : (*batch_)[b].training_features[c]) {
-#if defined(_OPENMP)
-            if (feature.GetIndex() % num_threads != thread_index) continue;
-#endif
-            const IndexType weights_offset =
-                kHalfDimensions * feature.GetIndex();
-            const auto scale = static_cast<LearnFloatType>(
-                effective_learning_rate / feature.GetCount());
-            cblas_saxpy(kHalfDimensions, -scale,
-                        &gradients_[output_offset], 1,
-                        &weights_[weights_offset], 1);
-          }
-        }
-      }
-    }
 #else
     for (IndexType i = 0; i < kHalfDimensions; ++i) {
       biases_diff_[i] *= momentum_;
     }
-    for (IndexType b = 0; b < batch_->size(); ++b) {
+    for (IndexType b = 0; b < batch_.size(); ++b) {
       const IndexType batch_offset = kOutputDimensions * b;
       for (IndexType c = 0; c < 2; ++c) {
         const IndexType output_offset = batch_offset + kHalfDimensions * c;
@@ -201,41 +177,54 @@ class Trainer<FeatureTransformer> {
     for (IndexType i = 0; i < kHalfDimensions; ++i) {
       biases_[i] -= local_learning_rate * biases_diff_[i];
     }
-    for (IndexType b = 0; b < batch_->size(); ++b) {
-      const IndexType batch_offset = kOutputDimensions * b;
-      for (IndexType c = 0; c < 2; ++c) {
-        const IndexType output_offset = batch_offset + kHalfDimensions * c;
-        for (const auto& feature : (*batch_)[b].training_features[c]) {
-          const IndexType weights_offset = kHalfDimensions * feature.GetIndex();
-          const auto scale = static_cast<LearnFloatType>(
-              effective_learning_rate / feature.GetCount());
-          for (IndexType i = 0; i < kHalfDimensions; ++i) {
-            weights_[weights_offset + i] -=
-                scale * gradients_[output_offset + i];
-          }
-        }
-      }
-    }
 #endif
-    for (IndexType b = 0; b < batch_->size(); ++b) {
-      for (IndexType c = 0; c < 2; ++c) {
-        for (const auto& feature : (*batch_)[b].training_features[c]) {
-          observed_features.set(feature.GetIndex());
+    // Each partition updates and marks as observed only the features it owns,
+    // so no two tasks write the same weights or flags
+    const IndexType num_partitions =
+        static_cast<IndexType>(std::max(Tasks.size(), size_t(1)));
+    Tasks.parallel_for(0, num_partitions, 1, [&](size_t first, size_t last) {
+      for (IndexType b = 0; b < batch_.size(); ++b) {
+        const IndexType batch_offset = kOutputDimensions * b;
+        for (IndexType c = 0; c < 2; ++c) {
+          const IndexType output_offset = batch_offset + kHalfDimensions * c;
+          for (const auto& feature : batch_[b].training_features[c]) {
+            const IndexType partition = feature.GetIndex() % num_partitions;
+            if (partition < first || partition >= last) continue;
+            observed_features[feature.GetIndex()] = true;
+            const IndexType weights_offset =
+                kHalfDimensions * feature.GetIndex();
+            const auto scale = static_cast<LearnFloatType>(
+                effective_learning_rate / feature.GetCount());
+#if defined(USE_BLAS)
+            cblas_saxpy(kHalfDimensions, -scale,
+                        &gradients_[output_offset], 1,
+                        &weights_[weights_offset], 1);
+#else
+            for (IndexType i = 0; i < kHalfDimensions; ++i) {
+              weights_[weights_offset + i] -=
+                  scale * gradients_[output_offset + i];
+            }
+#endif
+          }
         }
       }
-    }
+    });
   }
 
  private:
   // constructor
   Trainer(LayerType* target_layer) :
-      batch_(nullptr),
+      batch_(),
       target_layer_(target_layer),
       biases_(),
       weights_(),
       biases_diff_(),
+      observed_features(),
       momentum_(0.0),
-      learning_rate_scale_(1.0) {
+      learning_rate_scale_(1.0),
+      health_sample_interval_(1),
+      num_batches_(0),
+      num_sampled_batches_(0) {
     min_pre_activation_ = std::numeric_limits<LearnFloatType>::max();
     max_pre_activation_ = std::numeric_limits<LearnFloatType>::lowest();
     std::fill(std::begin(min_activations_), std::end(min_activations_),
@@ -251,21 +240,23 @@ class Trainer<FeatureTransformer> {
       target_layer_->biases_[i] =
           Round<typename LayerType::BiasType>(biases_[i] * kBiasScale);
     }
-    std::vector<TrainingFeature> training_features;
-#pragma omp parallel for private(training_features)
-    for (IndexType j = 0; j < RawFeatures::kDimensions; ++j) {
-      training_features.clear();
-      Features::Factorizer<RawFeatures>::AppendTrainingFeatures(
-          j, &training_features);
-      for (IndexType i = 0; i < kHalfDimensions; ++i) {
-        double sum = 0.0;
-        for (const auto& feature : training_features) {
-          sum += weights_[kHalfDimensions * feature.GetIndex() + i];
+    Tasks.parallel_for(0, RawFeatures::kDimensions, kFeatureGrain,
+                       [&](size_t first, size_t last) {
+      std::vector<TrainingFeature> training_features;
+      for (IndexType j = first; j < last; ++j) {
+        training_features.clear();
+        Features::Factorizer<RawFeatures>::AppendTrainingFeatures(
+            j, &training_features);
+        for (IndexType i = 0; i < kHalfDimensions; ++i) {
+          double sum = 0.0;
+          for (const auto& feature : training_features) {
+            sum += weights_[kHalfDimensions * feature.GetIndex() + i];
+          }
+          target_layer_->weights_[kHalfDimensions * j + i] =
+              Round<typename LayerType::WeightType>(sum * kWeightScale);
         }
-        target_layer_->weights_[kHalfDimensions * j + i] =
-            Round<typename LayerType::WeightType>(sum * kWeightScale);
       }
-    }
+    });
   }
 
   // read parameterized integer
@@ -285,7 +276,7 @@ class Trainer<FeatureTransformer> {
   // Set the weight corresponding to the feature that does not appear in the learning data to 0
   void ClearUnobservedFeatureWeights() {
     for (IndexType i = 0; i < kInputDimensions; ++i) {
-      if (!observed_features.test(i)) {
+      if (!observed_features[i]) {
         std::fill(std::begin(weights_) + kHalfDimensions * i,
                   std::begin(weights_) + kHalfDimensions * (i + 1), +kZero);
       }
@@ -295,8 +286,13 @@ class Trainer<FeatureTransformer> {
 
   // Check if there are any problems with learning
   void CheckHealth() {
-    std::cout << "INFO: observed " << observed_features.count()
+    std::cout << "INFO: observed "
+              << std::count(std::begin(observed_features),
+                            std::end(observed_features), true)
               << " (out of " << kInputDimensions << ") features" << std::endl;
+    std::cout << "INFO: activation statistics of " << num_sampled_batches_
+              << " sampled mini-batches" << std::endl;
+    num_sampled_batches_ = 0;
 
     constexpr LearnFloatType kPreActivationLimit =
         std::numeric_limits<typename LayerType::WeightType>::max() /
@@ -336,8 +332,115 @@ class Trainer<FeatureTransformer> {
   static constexpr LearnFloatType kZero = static_cast<LearnFloatType>(0.0);
   static constexpr LearnFloatType kOne = static_cast<LearnFloatType>(1.0);
 
+  // number of examples / features handled by one task of the task pool
+  static constexpr std::size_t kBatchGrain = 64;
+  static constexpr std::size_t kFeatureGrain = 1024;
+
+  // number of SIMD registers accumulating a block of outputs in Propagate()
+  static constexpr IndexType kAccumulators = 8;
+
+  // Extremes of the outputs of a part of the mini-batch, for CheckHealth()
+  struct ActivationStats {
+    LearnFloatType min_pre_activation = std::numeric_limits<LearnFloatType>::max();
+    LearnFloatType max_pre_activation = std::numeric_limits<LearnFloatType>::lowest();
+    LearnFloatType min_activations[kHalfDimensions];
+    LearnFloatType max_activations[kHalfDimensions];
+
+    ActivationStats() {
+      std::fill(std::begin(min_activations), std::end(min_activations),
+                std::numeric_limits<LearnFloatType>::max());
+      std::fill(std::begin(max_activations), std::end(max_activations),
+                std::numeric_limits<LearnFloatType>::lowest());
+    }
+
+    void Merge(const ActivationStats& other) {
+      min_pre_activation = std::min(min_pre_activation, other.min_pre_activation);
+      max_pre_activation = std::max(max_pre_activation, other.max_pre_activation);
+      for (IndexType i = 0; i < kHalfDimensions; ++i) {
+        min_activations[i] = std::min(min_activations[i], other.min_activations[i]);
+        max_activations[i] = std::max(max_activations[i], other.max_activations[i]);
+      }
+    }
+  };
+
+  // Sum the weights of the active features of one perspective onto the biases
+  // and clamp the sums. Each block of outputs is kept in registers until all
+  // the feature rows have been added, instead of going through memory once
+  // per feature.
+  template <bool kGatherStats>
+  void PropagateHalf(const std::vector<TrainingFeature>& features,
+                     LearnFloatType* output, ActivationStats* stats) const {
+#if defined(USE_AVX2) || defined(USE_SSE2)
+    using namespace Detail;
+    constexpr IndexType kBlockSize = kAccumulators * kSimdLanes;
+    static_assert(kHalfDimensions % kBlockSize == 0, "");
+    SimdFloat min_pre_activation = Set(0.0f);
+    SimdFloat max_pre_activation = Set(0.0f);
+    if (kGatherStats) {
+      min_pre_activation = Set(stats->min_pre_activation);
+      max_pre_activation = Set(stats->max_pre_activation);
+    }
+    for (IndexType block = 0; block < kHalfDimensions; block += kBlockSize) {
+      SimdFloat sum[kAccumulators];
+      for (IndexType j = 0; j < kAccumulators; ++j) {
+        sum[j] = Load(&biases_[block + kSimdLanes * j]);
+      }
+      for (const auto& feature : features) {
+        const LearnFloatType* row =
+            &weights_[kHalfDimensions * feature.GetIndex() + block];
+        const SimdFloat count = Set(static_cast<float>(feature.GetCount()));
+        for (IndexType j = 0; j < kAccumulators; ++j) {
+          sum[j] = Add(sum[j], Mul(count, Load(&row[kSimdLanes * j])));
+        }
+      }
+      for (IndexType j = 0; j < kAccumulators; ++j) {
+        const IndexType i = block + kSimdLanes * j;
+        const SimdFloat activation = Max(Set(kZero), Min(Set(kOne), sum[j]));
+        Store(&output[i], activation);
+        if (kGatherStats) {
+          min_pre_activation = Min(min_pre_activation, sum[j]);
+          max_pre_activation = Max(max_pre_activation, sum[j]);
+          Store(&stats->min_activations[i],
+                Min(Load(&stats->min_activations[i]), activation));
+          Store(&stats->max_activations[i],
+                Max(Load(&stats->max_activations[i]), activation));
+        }
+      }
+    }
+    if (!kGatherStats) {
+      return;
+    }
+    float lanes[2][kSimdLanes];
+    Store(lanes[0], min_pre_activation);
+    Store(lanes[1], max_pre_activation);
+    stats->min_pre_activation = *std::min_element(lanes[0], lanes[0] + kSimdLanes);
+    stats->max_pre_activation = *std::max_element(lanes[1], lanes[1] + kSimdLanes);
+#else
+    std::copy(biases_, biases_ + kHalfDimensions, output);
+    for (const auto& feature : features) {
+      const IndexType weights_offset = kHalfDimensions * feature.GetIndex();
+      for (IndexType i = 0; i < kHalfDimensions; ++i) {
+        output[i] += feature.GetCount() * weights_[weights_offset + i];
+      }
+    }
+    if (!kGatherStats) {
+      for (IndexType i = 0; i < kHalfDimensions; ++i) {
+        output[i] = std::max(+kZero, std::min(+kOne, output[i]));
+      }
+      return;
+    }
+    for (IndexType i = 0; i < kHalfDimensions; ++i) {
+      stats->min_pre_activation = std::min(stats->min_pre_activation, output[i]);
+      stats->max_pre_activation = std::max(stats->max_pre_activation, output[i]);
+      output[i] = std::max(+kZero, std::min(+kOne, output[i]));
+      stats->min_activations[i] = std::min(stats->min_activations[i], output[i]);
+      stats->max_activations[i] = std::max(stats->max_activations[i], output[i]);
+    }
+#endif
+  }
+
   // mini batch
-  const std::vector<Example>* batch_;
+  ExampleBatch batch_;
 
   // layer to learn
   LayerType* const target_layer_;
@@ -355,12 +458,18 @@ class Trainer<FeatureTransformer> {
   std::vector<LearnFloatType> output_;
 
   // Features that appeared in the training data
-  std::bitset<kInputDimensions> observed_features;
+  bool observed_features[kInputDimensions];
 
   // hyper parameter
   LearnFloatType momentum_;
   LearnFloatType learning_rate_scale_;
 
+  // The health check statistics are gathered from one mini-batch in
+  // health_sample_interval_
+  std::uint64_t health_sample_interval_;
+  std::uint64_t num_batches_;
+  std::uint64_t num_sampled_batches_;
+
   // Health check statistics
   LearnFloatType min_pre_activation_;
   LearnFloatType max_pre_activation_;
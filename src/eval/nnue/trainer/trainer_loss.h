@@ -0,0 +1,232 @@
+﻿// Loss functions of NNUE evaluation function learning, computed for a whole mini-batch
+
+#ifndef _NNUE_TRAINER_LOSS_H_
+#define _NNUE_TRAINER_LOSS_H_
+
+#if defined(EVAL_LEARN) && defined(EVAL_NNUE)
+
+#include "../../../learn/learn.h"
+#include "trainer.h"
+#include "trainer_simd.h"
+
+#include <cmath>
+
+namespace Eval {
+
+namespace NNUE {
+
+namespace Detail {
+
+// exp() and log() of the single precision floating point numbers of a SIMD
+// register, with the polynomial approximations of the Cephes library.
+// Their relative error is about 1e-7, which is far below the noise of learning.
+#if defined(USE_AVX2) || defined(USE_SSE2)
+
+inline SimdFloat Exp(SimdFloat x) {
+  x = Max(Min(x, Set(88.3762626647949f)), Set(-88.3762626647949f));
+
+  // exp(x) = 2^n * exp(r) with n = round(x / ln(2)) and |r| <= ln(2) / 2
+  const SimdFloat n = Floor(Add(Mul(x, Set(1.44269504088896341f)), Set(0.5f)));
+  x = Sub(x, Mul(n, Set(0.693359375f)));
+  x = Sub(x, Mul(n, Set(-2.12194440e-4f)));
+
+  SimdFloat y = Set(1.9875691500e-4f);
+  y = Add(Mul(y, x), Set(1.3981999507e-3f));
+  y = Add(Mul(y, x), Set(8.3334519073e-3f));
+  y = Add(Mul(y, x), Set(4.1665795894e-2f));
+  y = Add(Mul(y, x), Set(1.6666665459e-1f));
+  y = Add(Mul(y, x), Set(5.0000001201e-1f));
+  y = Add(Add(Mul(y, Mul(x, x)), x), Set(1.0f));
+
+  return Mul(y, AsFloat(ShiftLeft23(AddInt(ToInt(n), SetInt(0x7f)))));
+}
+
+inline SimdFloat Log(SimdFloat x) {
+  // Only positive numbers are expected, the denormalized ones are cut off
+  x = Max(x, AsFloat(SetInt(0x00800000)));
+
+  // log(x) = e * ln(2) + log(m) with m in [sqrt(1/2), sqrt(2))
+  SimdFloat e = ToFloat(AddInt(ShiftRight23(AsInt(x)), SetInt(-0x7f + 1)));
+  x = Or(And(x, AsFloat(SetInt(~0x7f800000))), Set(0.5f));
+  const SimdFloat small = Less(x, Set(0.707106781186547524f));
+  e = Sub(e, And(small, Set(1.0f)));
+  x = Add(Sub(x, Set(1.0f)), And(x, small));
+
+  const SimdFloat z = Mul(x, x);
+  SimdFloat y = Set(7.0376836292e-2f);
+  y = Add(Mul(y, x), Set(-1.1514610310e-1f));
+  y = Add(Mul(y, x), Set(1.1676998740e-1f));
+  y = Add(Mul(y, x), Set(-1.2420140846e-1f));
+  y = Add(Mul(y, x), Set(1.4249322787e-1f));
+  y = Add(Mul(y, x), Set(-1.6668057665e-1f));
+  y = Add(Mul(y, x), Set(2.0000714765e-1f));
+  y = Add(Mul(y, x), Set(-2.4999993993e-1f));
+  y = Add(Mul(y, x), Set(3.3333331174e-1f));
+  y = Mul(Mul(y, x), z);
+
+  y = Add(y, Mul(e, Set(-2.12194440e-4f)));
+  y = Sub(y, Mul(z, Set(0.5f)));
+  return Add(Add(x, y), Mul(e, Set(0.693359375f)));
+}
+
+#endif  // defined(USE_AVX2) || defined(USE_SSE2)
+
+// Replace every value with its sigmoid
+inline void ApplySigmoid(float* values, std::size_t size) {
+  std::size_t i = 0;
+#if defined(USE_AVX2) || defined(USE_SSE2)
+  for (; i + kSimdLanes <= size; i += kSimdLanes) {
+    const SimdFloat exponential = Exp(Sub(Set(0.0f), Load(&values[i])));
+    Store(&values[i], Div(Set(1.0f), Add(Set(1.0f), exponential)));
+  }
+#endif
+  for (; i < size; ++i) {
+    values[i] = 1.0f / (1.0f + std::exp(-values[i]));
+  }
+}
+
+// Replace every value with its natural logarithm
+inline void ApplyLog(float* values, std::size_t size) {
+  std::size_t i = 0;
+#if defined(USE_AVX2) || defined(USE_SSE2)
+  for (; i + kSimdLanes <= size; i += kSimdLanes) {
+    Store(&values[i], Log(Load(&values[i])));
+  }
+#endif
+  for (; i < size; ++i) {
+    values[i] = std::log(values[i]);
+  }
+}
+
+}  // namespace Detail
+
+// Loss function of learning, computed for all the examples of a mini-batch at once.
+// The transcendental functions are evaluated over whole arrays with SIMD, the
+// rest of the work is simple loops over the batch.
+class Loss {
+ public:
+  Loss() : function_(Learner::LossFunction::ElmoMethod),
+           lambda_(0.33), lambda2_(0.33), lambda_limit_(32000.0) {}
+
+  // Select the loss function and the parameters of the elmo method
+  void SetFunction(Learner::LossFunction function,
+                   double lambda, double lambda2, double lambda_limit) {
+    function_ = function;
+    lambda_ = lambda;
+    lambda2_ = lambda2;
+    lambda_limit_ = lambda_limit;
+  }
+
+  // Set the gradient of the loss with respect to the network output of every
+  // example, scaled by its weight, and return the sum of the losses
+  double Compute(const ExampleBatch& batch,
+                 const LearnFloatType* network_output,
+                 LearnFloatType* gradients) {
+    const std::size_t size = batch.size();
+    shallow_.resize(size);
+    deep_.resize(size);
+    for (std::size_t b = 0; b < size; ++b) {
+      shallow_[b] = std::floor(static_cast<float>(
+          batch[b].sign * network_output[b] * kPonanzaConstant) + 0.5f);
+      deep_[b] = static_cast<float>(batch[b].psv.score);
+    }
+
+    // Factor converting an evaluation value to the argument of the sigmoid
+    // giving its winning percentage, see Learner::winning_percentage()
+    const float scale = static_cast<float>(std::log(10.0) / 4.0 / PawnValueEg);
+    double loss = 0.0;
+
+    switch (function_) {
+      case Learner::LossFunction::CrossEntropyForValue:
+        for (std::size_t b = 0; b < size; ++b) {
+          const float difference = shallow_[b] - deep_[b];
+          gradients[b] = difference;
+          loss += 0.5 * difference * difference;
+        }
+        break;
+
+      case Learner::LossFunction::WinningPercentage: {
+        buffer_.resize(3 * size);
+        float* const q = &buffer_[0];
+        float* const p = &buffer_[size];
+        float* const d = &buffer_[2 * size];
+        for (std::size_t b = 0; b < size; ++b) {
+          q[b] = shallow_[b] * scale;
+          p[b] = deep_[b] * scale;
+          d[b] = shallow_[b] / static_cast<float>(kPonanzaConstant);
+        }
+        Detail::ApplySigmoid(q, 3 * size);
+        for (std::size_t b = 0; b < size; ++b) {
+          const float difference = q[b] - p[b];
+          gradients[b] = difference * d[b] * (1.0f - d[b]);
+          loss += 0.5 * difference * difference;
+        }
+        break;
+      }
+
+      case Learner::LossFunction::CrossEntropy:
+      case Learner::LossFunction::ElmoMethod: {
+        // The target m mixes the winning percentage of the teacher with the game
+        // result, the loss is the cross entropy of q and m minus the entropy of m
+        constexpr float kEpsilon = 0.000001f;
+        buffer_.resize(6 * size);
+        float* const q = &buffer_[0];
+        float* const m = &buffer_[size];
+        float* const logs = &buffer_[2 * size];
+        for (std::size_t b = 0; b < size; ++b) {
+          q[b] = shallow_[b] * scale;
+          m[b] = deep_[b] * scale;
+        }
+        Detail::ApplySigmoid(q, 2 * size);
+        if (function_ == Learner::LossFunction::ElmoMethod) {
+          for (std::size_t b = 0; b < size; ++b) {
+            const float lambda = static_cast<float>(
+                std::abs(deep_[b]) >= lambda_limit_ ? lambda2_ : lambda_);
+            const float t = (batch[b].psv.game_result + 1) * 0.5f;
+            m[b] = lambda * m[b] + (1.0f - lambda) * t;
+          }
+        }
+        for (std::size_t b = 0; b < size; ++b) {
+          logs[b] = q[b] + kEpsilon;
+          logs[size + b] = 1.0f - q[b] + kEpsilon;
+          logs[2 * size + b] = m[b] + kEpsilon;
+          logs[3 * size + b] = 1.0f - m[b] + kEpsilon;
+        }
+        Detail::ApplyLog(logs, 4 * size);
+        for (std::size_t b = 0; b < size; ++b) {
+          gradients[b] = q[b] - m[b];
+          loss += m[b] * (logs[2 * size + b] - logs[b])
+                + (1.0f - m[b]) * (logs[3 * size + b] - logs[size + b]);
+        }
+        break;
+      }
+    }
+
+    for (std::size_t b = 0; b < size; ++b) {
+      gradients[b] = static_cast<LearnFloatType>(
+          batch[b].sign * gradients[b] * batch[b].weight);
+    }
+    return loss;
+  }
+
+ private:
+  Learner::LossFunction function_;
+  double lambda_;
+  double lambda2_;
+  double lambda_limit_;
+
+  // Evaluation values of the network and of the teacher
+  std::vector<float> shallow_;
+  std::vector<float> deep_;
+
+  // Intermediate values of the loss function
+  std::vector<float> buffer_;
+};
+
+}  // namespace NNUE
+
+}  // namespace Eval
+
+#endif  // defined(EVAL_LEARN) && defined(EVAL_NNUE)
+
+#endif
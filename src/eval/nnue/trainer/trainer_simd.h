@@ -0,0 +1,90 @@
+﻿// Thin wrappers of the single precision SIMD instructions used by the learner
+
+#ifndef _NNUE_TRAINER_SIMD_H_
+#define _NNUE_TRAINER_SIMD_H_
+
+#if defined(EVAL_LEARN) && defined(EVAL_NNUE)
+
+#include "../nnue_common.h"
+
+#include <cstddef>
+
+namespace Eval {
+
+namespace NNUE {
+
+namespace Detail {
+
+// The kernels of the trainer are written once with these functions and built
+// for the widest instruction set enabled, AVX2 or SSE2.
+#if defined(USE_AVX2) || defined(USE_SSE2)
+
+#if defined(USE_AVX2)
+using SimdFloat = __m256;
+using SimdInt = __m256i;
+constexpr std::size_t kSimdLanes = 8;
+
+inline SimdFloat Set(float a) { return _mm256_set1_ps(a); }
+inline SimdFloat Load(const float* p) { return _mm256_loadu_ps(p); }
+inline void Store(float* p, SimdFloat a) { _mm256_storeu_ps(p, a); }
+inline SimdFloat Add(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a, b); }
+inline SimdFloat Sub(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a, b); }
+inline SimdFloat Mul(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a, b); }
+inline SimdFloat Div(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a, b); }
+inline SimdFloat Min(SimdFloat a, SimdFloat b) { return _mm256_min_ps(a, b); }
+inline SimdFloat Max(SimdFloat a, SimdFloat b) { return _mm256_max_ps(a, b); }
+inline SimdFloat And(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a, b); }
+inline SimdFloat Or(SimdFloat a, SimdFloat b) { return _mm256_or_ps(a, b); }
+inline SimdFloat Less(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline SimdFloat Floor(SimdFloat a) { return _mm256_floor_ps(a); }
+inline SimdInt ToInt(SimdFloat a) { return _mm256_cvttps_epi32(a); }
+inline SimdFloat ToFloat(SimdInt a) { return _mm256_cvtepi32_ps(a); }
+inline SimdFloat AsFloat(SimdInt a) { return _mm256_castsi256_ps(a); }
+inline SimdInt AsInt(SimdFloat a) { return _mm256_castps_si256(a); }
+inline SimdInt SetInt(int a) { return _mm256_set1_epi32(a); }
+inline SimdInt AddInt(SimdInt a, SimdInt b) { return _mm256_add_epi32(a, b); }
+inline SimdInt ShiftLeft23(SimdInt a) { return _mm256_slli_epi32(a, 23); }
+inline SimdInt ShiftRight23(SimdInt a) { return _mm256_srli_epi32(a, 23); }
+#else
+using SimdFloat = __m128;
+using SimdInt = __m128i;
+constexpr std::size_t kSimdLanes = 4;
+
+inline SimdFloat Set(float a) { return _mm_set1_ps(a); }
+inline SimdFloat Load(const float* p) { return _mm_loadu_ps(p); }
+inline void Store(float* p, SimdFloat a) { _mm_storeu_ps(p, a); }
+inline SimdFloat Add(SimdFloat a, SimdFloat b) { return _mm_add_ps(a, b); }
+inline SimdFloat Sub(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a, b); }
+inline SimdFloat Mul(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a, b); }
+inline SimdFloat Div(SimdFloat a, SimdFloat b) { return _mm_div_ps(a, b); }
+inline SimdFloat Min(SimdFloat a, SimdFloat b) { return _mm_min_ps(a, b); }
+inline SimdFloat Max(SimdFloat a, SimdFloat b) { return _mm_max_ps(a, b); }
+inline SimdFloat And(SimdFloat a, SimdFloat b) { return _mm_and_ps(a, b); }
+inline SimdFloat Or(SimdFloat a, SimdFloat b) { return _mm_or_ps(a, b); }
+inline SimdFloat Less(SimdFloat a, SimdFloat b) { return _mm_cmplt_ps(a, b); }
+inline SimdFloat ToFloat(SimdInt a) { return _mm_cvtepi32_ps(a); }
+inline SimdFloat Floor(SimdFloat a) {
+  // SSE2 has no rounding instruction: truncate, then step down the negative numbers
+  const SimdFloat truncated = ToFloat(_mm_cvttps_epi32(a));
+  return Sub(truncated, And(Less(a, truncated), Set(1.0f)));
+}
+inline SimdInt ToInt(SimdFloat a) { return _mm_cvttps_epi32(a); }
+inline SimdFloat AsFloat(SimdInt a) { return _mm_castsi128_ps(a); }
+inline SimdInt AsInt(SimdFloat a) { return _mm_castps_si128(a); }
+inline SimdInt SetInt(int a) { return _mm_set1_epi32(a); }
+inline SimdInt AddInt(SimdInt a, SimdInt b) { return _mm_add_epi32(a, b); }
+inline SimdInt ShiftLeft23(SimdInt a) { return _mm_slli_epi32(a, 23); }
+inline SimdInt ShiftRight23(SimdInt a) { return _mm_srli_epi32(a, 23); }
+#endif
+
+#endif  // defined(USE_AVX2) || defined(USE_SSE2)
+
+}  // namespace Detail
+
+}  // namespace NNUE
+
+}  // namespace Eval
+
+#endif  // defined(EVAL_LEARN) && defined(EVAL_NNUE)
+
+#endif
@@ -47,7 +47,7 @@ class Trainer<Layers::Sum<FirstPreviousLayer, RemainingPreviousLayers...>> :
   }
 
   // forward propagation
-  /*const*/ LearnFloatType* Propagate(const std::vector<Example>& batch) {
+  /*const*/ LearnFloatType* Propagate(const ExampleBatch& batch) {
     batch_size_ = static_cast<IndexType>(batch.size());
     auto output = Tail::Propagate(batch);
     const auto head_output = previous_layer_trainer_->Propagate(batch);
@@ -127,7 +127,7 @@ class Trainer<Layers::Sum<PreviousLayer>> {
   }
 
   // forward propagation
-  /*const*/ LearnFloatType* Propagate(const std::vector<Example>& batch) {
+  /*const*/ LearnFloatType* Propagate(const ExampleBatch& batch) {
     if (output_.size() < kOutputDimensions * batch.size()) {
       output_.resize(kOutputDimensions * batch.size());
     }
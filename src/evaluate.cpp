@@ -894,6 +894,7 @@ namespace {
 /// evaluation of the position from the point of view of the side to move.
 
 Value Eval::evaluate(const Position& pos) {
+  pos.this_thread()->counters.count(EVALS);
   if (Options["EvalNNUE"])
   	return NNUE::evaluate(pos);
   else
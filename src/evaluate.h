@@ -35,6 +35,23 @@ Value evaluate(const Position& pos);
 
 void evaluate_with_no_return(const Position& pos);
 
+#if defined(EVAL_NNUE)
+// Prefetch the weight columns that the next difference calculation will read.
+// Called from do_move() as soon as dirtyPiece is known.
+void prefetch_feature_weights(const Position& pos);
+
+// Prefetch what evaluating the position after the pseudo legal move m, whose
+// key is given, will read: its eval hash entry and the weight columns of the
+// difference calculation. Used by the search for moves it is about to make.
+void prefetch_move(const Position& pos, Move m, Key key);
+
+// Whether evaluations are stored in the eval hash, set by the UseEvalHash option
+extern bool useEvalHash;
+
+// Whether the NNUE evaluation is used, set by the EvalNNUE option
+extern bool useNNUE;
+#endif
+
 Value compute_eval(const Position& pos);
 
 #if defined(EVAL_NNUE) || defined(EVAL_LEARN)
@@ -0,0 +1,490 @@
+﻿// "datastats" command
+//
+// Scan packed sfen training files (PackedSfenValue records) and report what they contain
+// without converting them to text: histograms of gamePly, score, game result, piece count and
+// side to move, an estimate of the number of distinct positions, and the number of broken
+// records. Every file is memory mapped and its records are shared among the workers of the
+// task pool, so a large data set is read at the speed of the disk.
+//
+// Example) datastats a.bin b.bin c.bin
+
+#if defined(EVAL_LEARN)
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "learn.h"
+#include "../bitboard.h"
+#include "../misc.h"
+#include "../position.h"
+#include "../task_pool.h"
+#include "../thread.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#ifndef NOMINMAX
+#  define NOMINMAX // Disable macros min() and max()
+#endif
+#include <windows.h>
+#endif
+
+using namespace std;
+
+namespace Learner
+{
+	namespace
+	{
+		// Histogram layout. The last bucket of gamePly and the first and last buckets of
+		// score also take everything beyond them.
+		constexpr int PlyStep = 20;
+		constexpr int PlyBuckets = 21;
+		constexpr int ScoreStep = 250;
+		constexpr int ScoreLimit = 3000;
+		constexpr int ScoreBuckets = 2 * ScoreLimit / ScoreStep + 2;
+
+		// HyperLogLog with 2^14 registers, the standard error of the estimate is about 0.8%
+		constexpr int HllBits = 14;
+		constexpr size_t HllRegisters = size_t(1) << HllBits;
+
+		// Statistics of a range of records. The ranges are scanned independently and merged.
+		struct DataStats
+		{
+			uint64_t records = 0;
+			uint64_t undecodable = 0;
+			uint64_t illegal = 0;
+			uint64_t bad_move = 0;
+
+			uint64_t ply[PlyBuckets] = {};
+			uint64_t score[ScoreBuckets] = {};
+			uint64_t result[4] = {}; // loss, draw, win, anything else
+			uint64_t pieces[33] = {};
+			uint64_t side_to_move[COLOR_NB] = {};
+
+			uint8_t hll[HllRegisters] = {};
+
+			DataStats& operator+=(const DataStats& s)
+			{
+				records += s.records;
+				undecodable += s.undecodable;
+				illegal += s.illegal;
+				bad_move += s.bad_move;
+
+				for (int i = 0; i < PlyBuckets; ++i)
+					ply[i] += s.ply[i];
+				for (int i = 0; i < ScoreBuckets; ++i)
+					score[i] += s.score[i];
+				for (int i = 0; i < 4; ++i)
+					result[i] += s.result[i];
+				for (int i = 0; i < 33; ++i)
+					pieces[i] += s.pieces[i];
+				for (auto c : Colors)
+					side_to_move[c] += s.side_to_move[c];
+
+				for (size_t i = 0; i < HllRegisters; ++i)
+					hll[i] = std::max(hll[i], s.hll[i]);
+
+				return *this;
+			}
+
+			void add_key(Key key)
+			{
+				// The high bits select the register, the register keeps the longest run of
+				// leading zeros seen in the remaining bits. The guard bit bounds the run.
+				const size_t idx = size_t(key >> (64 - HllBits));
+				const Bitboard w = (key << HllBits) | (Bitboard(1) << (HllBits - 1));
+				hll[idx] = std::max(hll[idx], uint8_t(64 - msb(w)));
+			}
+
+			// Number of distinct keys added, with the small range correction of linear counting
+			double distinct() const
+			{
+				const double m = double(HllRegisters);
+				double sum = 0.0;
+				size_t zeros = 0;
+				for (size_t i = 0; i < HllRegisters; ++i)
+				{
+					sum += std::ldexp(1.0, -hll[i]);
+					zeros += !hll[i];
+				}
+
+				const double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+				return estimate <= 2.5 * m && zeros ? m * std::log(m / zeros) : estimate;
+			}
+		};
+
+		// Walk the board of a packed sfen the way Position::set_from_packed_sfen() reads it,
+		// but without trusting the data: set_from_packed_sfen() loops forever on an unknown
+		// piece code and overruns its piece lists on impossible material.
+		// Returns false if the record cannot be decoded, sets legal to false if it decodes to
+		// something set_from_packed_sfen() must not be given.
+		bool check_packed_sfen(const PackedSfen& sfen, bool& legal)
+		{
+			int cursor = 0;
+			auto read_bits = [&](int n) {
+				int result = 0;
+				for (int i = 0; i < n; ++i, ++cursor)
+					if (cursor < 256)
+						result |= ((sfen.data[cursor / 8] >> (cursor & 7)) & 1) << i;
+				return result;
+			};
+
+			Piece board[SQUARE_NB] = {};
+			int count[PIECE_NB] = {};
+
+			read_bits(1); // side to move
+			const Square ksq[COLOR_NB] = { Square(read_bits(6)), Square(read_bits(6)) };
+			if (ksq[WHITE] == ksq[BLACK])
+				return false;
+
+			board[ksq[WHITE]] = W_KING;
+			board[ksq[BLACK]] = B_KING;
+
+			for (Rank r = RANK_8; r >= RANK_1; --r)
+				for (File f = FILE_A; f <= FILE_H; ++f)
+				{
+					const Square sq = make_square(f, r);
+					if (board[sq])
+						continue;
+
+					// Huffman codes of the piece types: 0, 0001, 0011, 0101, 0111, 1001
+					if (!read_bits(1))
+						continue;
+
+					PieceType pt;
+					switch (read_bits(3))
+					{
+					case 0: pt = PAWN;   break;
+					case 1: pt = KNIGHT; break;
+					case 2: pt = BISHOP; break;
+					case 3: pt = ROOK;   break;
+					case 4: pt = QUEEN;  break;
+					default: return false;
+					}
+
+					const Piece pc = make_piece(Color(read_bits(1)), pt);
+					board[sq] = pc;
+					++count[pc];
+
+					if (cursor > 256)
+						return false;
+				}
+
+			// Castling rights, en passant square, rule50 and fullmove number
+			const int castling = read_bits(4);
+			if (read_bits(1))
+				read_bits(6);
+			read_bits(6 + 8);
+
+			if (cursor > 256)
+				return false;
+
+			legal = true;
+			for (auto c : Colors)
+			{
+				int total = 1;
+				for (PieceType pt = PAWN; pt < KING; ++pt)
+					total += count[make_piece(c, pt)];
+
+				legal &= total <= 16 && count[make_piece(c, PAWN)] <= 8;
+			}
+
+			for (File f = FILE_A; f <= FILE_H; ++f)
+				for (Rank r : { RANK_1, RANK_8 })
+					legal &= type_of(board[make_square(f, r)]) != PAWN;
+
+			// The decoder looks for the castling rook from the corner, it must be there
+			const Square rook_sq[4] = { SQ_H1, SQ_A1, SQ_H8, SQ_A8 };
+			for (int i = 0; i < 4; ++i)
+				if (castling & (1 << i))
+				{
+					const Color c = Color(i / 2);
+					legal &=  ksq[c] == relative_square(c, SQ_E1)
+					       && board[rook_sq[i]] == make_piece(c, ROOK);
+				}
+
+			return true;
+		}
+
+		// Scan the records [first, last)
+		DataStats scan(const PackedSfenValue* records, size_t first, size_t last)
+		{
+			DataStats s;
+			Position pos;
+			StateInfo si;
+			Thread* th = Threads.main();
+
+			for (size_t i = first; i < last; ++i)
+			{
+				const PackedSfenValue& psv = records[i];
+
+				++s.records;
+				++s.ply[std::min(int(psv.gamePly) / PlyStep, PlyBuckets - 1)];
+				++s.score[std::clamp(int(psv.score) + ScoreLimit + ScoreStep, 0, 2 * ScoreLimit + ScoreStep) / ScoreStep];
+				++s.result[psv.game_result >= -1 && psv.game_result <= 1 ? psv.game_result + 1 : 3];
+
+				bool legal = false;
+				if (!check_packed_sfen(psv.sfen, legal))
+				{
+					++s.undecodable;
+					continue;
+				}
+
+				if (!legal)
+				{
+					++s.illegal;
+					continue;
+				}
+
+				pos.set_from_packed_sfen(psv.sfen, &si, th, false);
+
+				// The side that just moved must not have left its king in check
+				const Color us = pos.side_to_move();
+				if (pos.attackers_to(pos.square<KING>(~us)) & pos.pieces(us))
+				{
+					++s.illegal;
+					continue;
+				}
+
+				++s.side_to_move[us];
+				++s.pieces[popcount(pos.pieces())];
+				s.add_key(pos.key());
+
+				const Move m = Move(psv.move);
+				if (!pos.pseudo_legal(m) || !pos.legal(m))
+					++s.bad_move;
+			}
+
+			return s;
+		}
+
+		// Read-only mapping of a whole file
+		struct MappedFile
+		{
+			const void* data = nullptr;
+			size_t size = 0;
+#ifdef _WIN32
+			HANDLE mapping = nullptr;
+#endif
+
+			bool map(const string& path)
+			{
+#ifndef _WIN32
+				struct stat statbuf;
+				int fd = ::open(path.c_str(), O_RDONLY);
+
+				if (fd == -1)
+					return false;
+
+				if (fstat(fd, &statbuf))
+				{
+					::close(fd);
+					return false;
+				}
+
+				// An empty file can not be mapped, it is simply a file without records
+				if (statbuf.st_size == 0)
+				{
+					::close(fd);
+					return true;
+				}
+
+				void* base = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+				::close(fd);
+
+				if (base == MAP_FAILED)
+					return false;
+
+				// Every worker reads its range front to back
+				madvise(base, statbuf.st_size, MADV_SEQUENTIAL);
+
+				data = base;
+				size = statbuf.st_size;
+#else
+				HANDLE fd = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+				                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+				if (fd == INVALID_HANDLE_VALUE)
+					return false;
+
+				DWORD size_high;
+				DWORD size_low = GetFileSize(fd, &size_high);
+
+				if (size_low == INVALID_FILE_SIZE && GetLastError() != NO_ERROR)
+				{
+					CloseHandle(fd);
+					return false;
+				}
+
+				if (!size_low && !size_high)
+				{
+					CloseHandle(fd);
+					return true;
+				}
+
+				mapping = CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high, size_low, nullptr);
+				CloseHandle(fd);
+
+				if (!mapping)
+					return false;
+
+				data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+				if (!data)
+				{
+					CloseHandle(mapping);
+					return false;
+				}
+
+				size = size_t(uint64_t(size_high) << 32 | size_low);
+#endif
+				return true;
+			}
+
+			~MappedFile()
+			{
+				if (!data)
+					return;
+#ifndef _WIN32
+				munmap(const_cast<void*>(data), size);
+#else
+				UnmapViewOfFile(data);
+				CloseHandle(mapping);
+#endif
+			}
+		};
+
+		string percent(uint64_t n, uint64_t total)
+		{
+			stringstream ss;
+			ss << fixed << setprecision(2) << (total ? 100.0 * n / total : 0.0) << "%";
+			return ss.str();
+		}
+
+		void print_histogram(const string& title, const vector<string>& labels, const uint64_t* counts, uint64_t total)
+		{
+			cout << title << endl;
+			for (size_t i = 0; i < labels.size(); ++i)
+				if (counts[i])
+					cout << "  " << setw(14) << labels[i] << " : " << setw(12) << counts[i]
+					     << "  " << setw(7) << percent(counts[i], total) << endl;
+		}
+
+		void print_stats(const DataStats& s)
+		{
+			const uint64_t decoded = s.records - s.undecodable - s.illegal;
+			const double distinct = std::min(s.distinct(), double(decoded));
+
+			cout << "Records          : " << s.records << endl
+			     << "Undecodable      : " << s.undecodable << " (" << percent(s.undecodable, s.records) << ")" << endl
+			     << "Illegal position : " << s.illegal << " (" << percent(s.illegal, s.records) << ")" << endl
+			     << "Illegal move     : " << s.bad_move << " (" << percent(s.bad_move, decoded) << ")" << endl
+			     << "Distinct (est.)  : " << uint64_t(distinct)
+			     << ", duplicates " << percent(decoded - uint64_t(distinct), decoded) << endl;
+
+			vector<string> labels;
+			for (int i = 0; i < PlyBuckets; ++i)
+				labels.push_back(i < PlyBuckets - 1 ? to_string(i * PlyStep) + ".." + to_string((i + 1) * PlyStep - 1)
+				                                     : ">= " + to_string(i * PlyStep));
+			print_histogram("gamePly", labels, s.ply, s.records);
+
+			labels.clear();
+			for (int i = 0; i < ScoreBuckets; ++i)
+			{
+				const int low = i * ScoreStep - ScoreLimit - ScoreStep;
+				labels.push_back(i == 0                ? "< " + to_string(-ScoreLimit)
+				               : i == ScoreBuckets - 1 ? ">= " + to_string(ScoreLimit)
+				                                       : to_string(low) + ".." + to_string(low + ScoreStep - 1));
+			}
+			print_histogram("score", labels, s.score, s.records);
+
+			print_histogram("game_result", { "loss", "draw", "win", "other" }, s.result, s.records);
+
+			labels.clear();
+			for (int i = 0; i <= 32; ++i)
+				labels.push_back(to_string(i));
+			print_histogram("pieces", labels, s.pieces, decoded);
+
+			print_histogram("side to move", { "white", "black" }, s.side_to_move, decoded);
+		}
+	}
+
+	// Report the statistics of every file and of all of them together
+	void data_stats(Position&, istringstream& is)
+	{
+		vector<string> filenames;
+		string filename;
+		while (is >> filename)
+			filenames.push_back(filename);
+
+		if (filenames.empty())
+		{
+			cout << "Usage: datastats file1 [file2 ...]" << endl;
+			return;
+		}
+
+		const size_t workers = std::max(Tasks.size(), size_t(1));
+		DataStats total;
+		uint64_t total_bytes = 0;
+		size_t failed = 0;
+		const TimePoint start = now();
+
+		for (auto& f : filenames)
+		{
+			MappedFile file;
+			if (!file.map(f))
+			{
+				cout << "Error! " << f << " can not be opened." << endl;
+				++failed;
+				continue;
+			}
+
+			const PackedSfenValue* records = static_cast<const PackedSfenValue*>(file.data);
+			const size_t count = file.size / sizeof(PackedSfenValue);
+
+			// A few large ranges per worker, each one read sequentially
+			const size_t grain = std::max(size_t(1) << 16, (count + 4 * workers - 1) / (4 * workers));
+
+			const TimePoint file_start = now();
+			const DataStats s = Tasks.reduce(size_t(0), count, grain, DataStats(),
+				[&](size_t first, size_t last) { return scan(records, first, last); },
+				[](DataStats a, const DataStats& b) { return a += b; });
+			const double seconds = std::max(now() - file_start, TimePoint(1)) / 1000.0;
+
+			cout << f << " : " << s.records << " records, "
+			     << fixed << setprecision(1) << file.size / (1024.0 * 1024.0) << " MB in " << seconds << " s, "
+			     << file.size / (1024.0 * 1024.0) / seconds << " MB/s, "
+			     << uint64_t(s.records / seconds) << " records/s, "
+			     << uint64_t(std::min(s.distinct(), double(s.records))) << " distinct (est.), "
+			     << s.undecodable + s.illegal << " broken" << endl;
+
+			if (file.size % sizeof(PackedSfenValue))
+				cout << "Warning! " << f << " ends with a partial record of "
+				     << file.size % sizeof(PackedSfenValue) << " bytes." << endl;
+
+			total += s;
+			total_bytes += file.size;
+		}
+
+		const double seconds = std::max(now() - start, TimePoint(1)) / 1000.0;
+		cout << "Total : " << filenames.size() - failed << " files";
+		if (failed)
+			cout << " (" << failed << " could not be opened)";
+		cout << ", "
+		     << fixed << setprecision(1) << total_bytes / (1024.0 * 1024.0) << " MB in " << seconds << " s, "
+		     << total_bytes / (1024.0 * 1024.0) / seconds << " MB/s" << endl;
+		cout.unsetf(ios::fixed);
+
+		print_stats(total);
+	}
+}
+
+#endif // EVAL_LEARN
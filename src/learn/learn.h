@@ -230,6 +230,10 @@ namespace Learner
 
 	double calc_grad(Value shallow, const PackedSfenValue& psv);
 
+	// Objective functions that the NNUE training can select at runtime with the loss option of the learn command.
+	// The default one is the objective function selected above.
+	enum class LossFunction { ElmoMethod, WinningPercentage, CrossEntropy, CrossEntropyForValue };
+
 }
 
 #endif
@@ -63,10 +63,6 @@
 #include <cmath>	// std::exp(),std::pow(),std::log()
 #include <cstring>	// memcpy()
 
-#if defined (_OPENMP)
-#include <omp.h>
-#endif
-
 #if defined(_MSC_VER)
 // The C++ filesystem cannot be used unless it is C++17 or later or MSVC.
 // I tried to use windows.h, but with g++ of msys2 I can not get the files in the folder well.
@@ -79,7 +75,7 @@
 #include "../misc.h"
 #include "../thread.h"
 #include "../position.h"
-//#include "../extra/book/book.h"
+#include "../book.h"
 #include "../tt.h"
 #include "multi_think.h"
 
@@ -90,9 +86,6 @@
 
 using namespace std;
 
-//// This is defined in the search section.
-//extern Book::BookMoveSelector book;
-
 // Addition and subtraction definition for atomic<T>
 // Aligned with atomicAdd() in Apery/learner.hpp.
 template <typename T>
@@ -129,14 +122,14 @@ bool use_game_draw_adjudication = false;
 struct SfenWriter
 {
 		// File name to write and number of threads to create
-	SfenWriter(string filename, int thread_num)
+	// With shards > 1, the positions are scattered at random into that many files, see open_files().
+	SfenWriter(string filename, int thread_num, size_t shards_ = 1)
+		: shards(std::max(shards_, (size_t)1)), prng(std::random_device()())
 	{
 		sfen_buffers_pool.reserve((size_t)thread_num * 10);
 		sfen_buffers.resize(thread_num);
 
-		// When performing additional learning, the quality of the teacher generated after learning the evaluation function does not change much and I want to earn more teacher positions.
-		// Since it is preferable that old teachers also use it, it has such a specification.
-		fs.open(filename, ios::out | ios::binary | ios::app);
+		open_files(filename);
 		filename_ = filename;
 
 		finished = false;
@@ -146,7 +139,7 @@ struct SfenWriter
 	{
 		finished = true;
 		file_worker_thread.join();
-		fs.close();
+		close_files();
 
 		// all buffers should be empty since file_worker_thread has written all..
 		for (auto p : sfen_buffers) { assert(p == nullptr); }
@@ -156,6 +149,9 @@ struct SfenWriter
 	// For each thread, flush the file by this number of phases.
 	const size_t SFEN_WRITE_SIZE = 5000;
 
+	// For each shard, write to the file by this number of phases.
+	const size_t SHARD_WRITE_SIZE = 1000;
+
 	// write one by pairing the phase and evaluation value (in packed sfen format)
 	void write(size_t thread_id, const PackedSfenValue& psv)
 	{
@@ -218,7 +214,8 @@ struct SfenWriter
 			sync_cout << endl << sfen_write_count << " sfens , at " << now_string() << sync_endl;
 
 			// This is enough for flush().
-			fs.flush();
+			for (auto& fs : files)
+				fs.flush();
 		};
 
 		while (!finished || sfen_buffers_pool.size())
@@ -239,7 +236,7 @@ struct SfenWriter
 			{
 				for (auto ptr : buffers)
 				{
-					fs.write((const char*)&((*ptr)[0]), sizeof(PackedSfenValue) * ptr->size());
+					write_to_files(*ptr);
 
 					sfen_write_count += ptr->size();
 
@@ -251,13 +248,13 @@ struct SfenWriter
 						save_every_counter = 0;
 						// Change the file name.
 
-						fs.close();
+						close_files();
 
 						// Sequential number attached to the file
 						int n = (int)(sfen_write_count / save_every);
 						// Rename the file and open it again. Add ios::app in consideration of overwriting. (Depending on the operation, it may not be necessary.)
 						string filename = filename_ + "_" + std::to_string(n);
-						fs.open(filename, ios::out | ios::binary | ios::app);
+						open_files(filename);
 						cout << endl << "output sfen file = " << filename << endl;
 					}
 #endif
@@ -277,6 +274,9 @@ struct SfenWriter
 			}
 		}
 
+		// Write what is left in the shard buffers.
+		flush_shard_buffers();
+
 		// Output the time stamp again before the end.
 		output_status();
 	}
@@ -286,7 +286,66 @@ struct SfenWriter
 
 private:
 
-	fstream fs;
+	// Open the file, or with shards > 1 the files filename_shard0, filename_shard1, ...
+	// Every position goes to a shard drawn at random, so that each shard is a random sample of the whole generation
+	// and shuffling one shard in memory gives almost the same order as shuffling all of the files.
+	void open_files(const string& filename)
+	{
+		// When performing additional learning, the quality of the teacher generated after learning the evaluation function does not change much and I want to earn more teacher positions.
+		// Since it is preferable that old teachers also use it, it has such a specification.
+		files.resize(shards);
+		shard_buffers.resize(shards);
+		for (size_t i = 0; i < shards; ++i)
+			files[i].open(shards == 1 ? filename : filename + "_shard" + std::to_string(i), ios::out | ios::binary | ios::app);
+	}
+
+	void close_files()
+	{
+		flush_shard_buffers();
+		for (auto& fs : files)
+			fs.close();
+	}
+
+	// Write the phases to the file, or scatter them into the shards.
+	void write_to_files(const PSVector& sfens)
+	{
+		if (shards == 1)
+		{
+			files[0].write((const char*)&sfens[0], sizeof(PackedSfenValue) * sfens.size());
+			return;
+		}
+
+		for (const auto& psv : sfens)
+		{
+			const size_t i = (size_t)prng.rand(shards);
+			shard_buffers[i].push_back(psv);
+			if (shard_buffers[i].size() >= SHARD_WRITE_SIZE)
+			{
+				files[i].write((const char*)&shard_buffers[i][0], sizeof(PackedSfenValue) * shard_buffers[i].size());
+				shard_buffers[i].clear();
+			}
+		}
+	}
+
+	void flush_shard_buffers()
+	{
+		for (size_t i = 0; i < shard_buffers.size(); ++i)
+			if (!shard_buffers[i].empty())
+			{
+				files[i].write((const char*)&shard_buffers[i][0], sizeof(PackedSfenValue) * shard_buffers[i].size());
+				shard_buffers[i].clear();
+			}
+	}
+
+	// Number of output files
+	const size_t shards;
+
+	// Output files, one for each shard
+	std::vector<fstream> files;
+
+	// Phases waiting to be written to each shard, and the random number generator that picks the shard of a phase
+	std::vector<PSVector> shard_buffers;
+	PRNG prng;
 
 	// File name passed in the constructor
 	std::string filename_;
@@ -370,6 +429,18 @@ struct MultiThinkGenSfen : public MultiThink
 	int write_minply;
 	int write_maxply;
 
+	// Filters keeping the tactical positions out of the written phases, so that the learner gets quiet ones.
+	// filter_in_check skips the positions in check, filter_capture the ones whose best move is a capture or a promotion,
+	// filter_qsearch_margin the ones whose qsearch() value differs from the static evaluation by more than this. (-1 = off)
+	bool filter_in_check = false;
+	bool filter_capture = false;
+	int filter_qsearch_margin = -1;
+
+	// Number of phases skipped by each filter
+	std::atomic<uint64_t> rejected_in_check{0};
+	std::atomic<uint64_t> rejected_capture{0};
+	std::atomic<uint64_t> rejected_qsearch{0};
+
 	// sfen exporter
 	SfenWriter& sw;
 
@@ -387,7 +458,8 @@ void MultiThinkGenSfen::thread_worker(size_t thread_id)
 	const int MAX_PLY2 = write_maxply;
 
 	//Maximum StateInfo + Search PV to advance to leaf buffer
-	std::vector<StateInfo,AlignedAllocator<StateInfo>> states(MAX_PLY2 + MAX_PLY /* == search_depth + α */);
+	// (states_per_thread is MAX_PLY2 + MAX_PLY /* == search_depth + α */)
+	StateInfo* states = thread_states(thread_id);
 	StateInfo si;
 
 	// This move. Use this move to advance the stage.
@@ -402,6 +474,18 @@ void MultiThinkGenSfen::thread_worker(size_t thread_id)
 	int adj_draw_cnt = 8;  // 4 move scores for each side have to be checked
 	int adj_draw_score = 0;  // move score in CP
 
+	// Number of plies played from the book, if one is set with BookFile.
+	const int book_moves = (int)Options["BookMoves"];
+
+	// Buffers of a game, cleared at the start of every game so that their memory is reused.
+	PSVector a_psv;
+	a_psv.reserve(MAX_PLY2 + MAX_PLY);
+	vector<bool> random_move_flag;
+	vector<int> a;
+	a.reserve((size_t)random_move_maxply);
+	vector<int> move_hist_scores;
+	move_hist_scores.reserve(MAX_PLY2);
+
 	// repeat until the specified number of times
 	while (!quit)
 	{
@@ -423,29 +507,24 @@ void MultiThinkGenSfen::thread_worker(size_t thread_id)
     //  assert(actual == StartFEN);
     //}
 
-		// Refer to the members of BookMoveSelector defined in the search section.
-		//auto& book = ::book;
-
 		// Save the situation for one station, and write it out including the winning and losing at the end.
 		// The function to write is flush_psv() below this.
-		PSVector a_psv;
-		a_psv.reserve(MAX_PLY2 + MAX_PLY);
+		a_psv.clear();
 
 		// Write out the phases loaded in a_psv to a file.
-		// lastTurnIsWin: win/loss in the next phase after the final phase in a_psv
+		// lastTurnIsWin: win/loss of the side to move in the current phase, the one after the final phase in a_psv
 		// 1 when winning. -1 when losing. Pass 0 for a draw.
 		// Return value: true if the specified number of phases has already been reached and the process ends.
 		auto flush_psv = [&](int8_t lastTurnIsWin)
 		{
-			int8_t isWin = lastTurnIsWin;
-
 			// From the final stage (one step before) to the first stage, give information on the outcome of the game for each stage.
-			// The phases stored in a_psv are assumed to be continuous (in order).
+			// The filters may leave gaps between the phases stored in a_psv, so the result is given from the side to move
+			// of each phase, the first bit of its packed sfen.
 			for (auto it = a_psv.rbegin(); it != a_psv.rend(); ++it)
 			{
-				// If isWin == 0 (draw), multiply by -1 and it will remain 0 (draw)
-				isWin = - isWin;
-				it->game_result = isWin;
+				// If lastTurnIsWin == 0 (draw), it will remain 0 (draw)
+				const Color us = Color(it->sfen.data[0] & 1);
+				it->game_result = int8_t(us == pos.side_to_move() ? lastTurnIsWin : -lastTurnIsWin);
 
 				// When I tried to write out the phase, it reached the specified number of times.
 				// Because the counter is added in get_next_loop_count()
@@ -469,7 +548,7 @@ void MultiThinkGenSfen::thread_worker(size_t thread_id)
 		};
 
 		// ply flag for whether or not to randomly move by eyes
-		vector<bool> random_move_flag;
+		random_move_flag.clear();
 		{
 			// If you want to add a random move, random_move_maxply be sure to enter random_move_count times before the first move.
 			// I want you to disperse so much.
@@ -479,8 +558,7 @@ void MultiThinkGenSfen::thread_worker(size_t thread_id)
 			// Fisher-Yates shuffle and take out the first N items.
 			// Actually, I only want N pieces, so I only need to shuffle the first N pieces with Fisher-Yates.
 
-			vector<int> a;
-			a.reserve((size_t)random_move_maxply);
+			a.clear();
 
 			// random_move_minply ,random_move_maxply is specified by 1 origin,
 			// Note that we are handling 0 origin here.
@@ -504,7 +582,7 @@ void MultiThinkGenSfen::thread_worker(size_t thread_id)
 		int random_move_c = 0;
 
 		// Save history of move scores for adjudication
-		vector<int> move_hist_scores;
+		move_hist_scores.clear();
 
 		// ply: steps from the initial stage
 		for (int ply = 0; ; ++ply)
@@ -622,24 +700,20 @@ void MultiThinkGenSfen::thread_worker(size_t thread_id)
 				}
 			}
 
-			//// constant track
-			//if ((m = book.probe(pos)) != MOVE_NONE)
-			//{
-			//  // Hit the constant track.
-			//  // The move was stored in m.
-
-			//  // Do not use the fixed phase for learning.
-			//  a_psv.clear();
-
-			//  if (random_move_minply != -1)
-			// 		// Random move is performed with a certain probability even in the constant phase.
-			// 		goto RANDOM_MOVE;
-			//  else
-			// 		// When -1 is specified as random_move_minply, it points according to the standard until it goes out of the standard.
-			// 		// Prepare an innumerable number of situations that have left the constant as ConsiderationBookMoveCount true using a huge constant
-			// 		// Used for purposes such as performing a random move 5 times from there.
-			// 		goto DO_MOVE;
-			//}
+			// Follow the book for the first BookMoves plies of the game.
+			if (ply < book_moves && (m = Book::probe(pos, prng.rand<uint64_t>(), false)) != MOVE_NONE)
+			{
+				// Do not use the book positions for learning.
+				a_psv.clear();
+
+				if (random_move_minply != -1)
+					// Random move is performed with a certain probability even in the book.
+					goto RANDOM_MOVE;
+				else
+					// When -1 is specified as random_move_minply, the random moves are played
+					// once out of the book.
+					goto DO_MOVE;
+			}
 
 			{
 				// search_depth～search_depth2 Evaluation value of hand reading and PV (best responder row)
@@ -779,6 +853,27 @@ void MultiThinkGenSfen::thread_worker(size_t thread_id)
 					hash[hash_index] = key; // Replace with the current key.
 				}
 
+				// Skip the tactical positions. The phases before and after them are still written out.
+				if (filter_in_check && pos.checkers())
+				{
+					++rejected_in_check;
+					goto SKIP_SAVE;
+				}
+
+				if (filter_capture && !pv1.empty() && pos.capture_or_promotion(pv1[0]))
+				{
+					++rejected_capture;
+					goto SKIP_SAVE;
+				}
+
+				// The static evaluation is not defined in check
+				if (filter_qsearch_margin >= 0 && !pos.checkers()
+					&& abs(qsearch(pos).first - Eval::evaluate(pos)) > filter_qsearch_margin)
+				{
+					++rejected_qsearch;
+					goto SKIP_SAVE;
+				}
+
 				// Temporary saving of the situation.
 				{
 					a_psv.emplace_back(PackedSfenValue());
@@ -972,6 +1067,16 @@ void gen_sfen(Position&, istringstream& is)
 	// Add a random number to the end of the file name.
 	bool random_file_name = false;
 
+	// Scatter the phases at random into this number of files, output_file_name_shard0, output_file_name_shard1, ...
+	// so that the generated data need not be shuffled before learning.
+	int shards = 1;
+
+	// Do not write out the positions in check, the ones whose best move is a capture or a promotion,
+	// and the ones whose qsearch() value differs from the static evaluation by more than this. (-1 = off)
+	bool filter_in_check = false;
+	bool filter_capture = false;
+	int filter_qsearch_margin = -1;
+
 	while (true)
 	{
 		token = "";
@@ -1019,14 +1124,29 @@ void gen_sfen(Position&, istringstream& is)
 			is >> save_every;
 		else if (token == "random_file_name")
 			is >> random_file_name;
+		else if (token == "shards")
+			is >> shards;
 		else if (token == "use_draw_in_training_data_generation")
 			is >> use_draw_in_training_data_generation;
 		else if (token == "use_game_draw_adjudication")
 			is >> use_game_draw_adjudication;
+		else if (token == "filter_in_check")
+			is >> filter_in_check;
+		else if (token == "filter_capture")
+			is >> filter_capture;
+		else if (token == "filter_qsearch_margin")
+			is >> filter_qsearch_margin;
 		else
 			cout << "Error! : Illegal token " << token << endl;
 	}
 
+	// Every shard keeps a file open, a typo must not ask for millions of them.
+	if (shards < 1 || shards > 1024)
+	{
+		cout << "Error! : shards must be between 1 and 1024" << endl;
+		return;
+	}
+
 #if defined(USE_GLOBAL_OPTIONS)
 	// Save it for later restore.
 	auto oldGlobalOptions = GlobalOptions;
@@ -1075,11 +1195,15 @@ void gen_sfen(Position&, istringstream& is)
 		<< "  output_file_name       = " << output_file_name << endl
 		<< "  use_eval_hash          = " << use_eval_hash << endl
 		<< "  save_every             = " << save_every << endl
-		<< "  random_file_name       = " << random_file_name << endl;
+		<< "  random_file_name       = " << random_file_name << endl
+		<< "  shards                 = " << shards << endl
+		<< "  filter_in_check        = " << filter_in_check << endl
+		<< "  filter_capture         = " << filter_capture << endl
+		<< "  filter_qsearch_margin  = " << filter_qsearch_margin << endl;
 
 	// Create and execute threads as many as Options["Threads"].
 	{
-		SfenWriter sw(output_file_name, thread_num);
+		SfenWriter sw(output_file_name, thread_num, shards);
 		sw.save_every = save_every;
 
 		MultiThinkGenSfen multi_think(search_depth, search_depth2, sw);
@@ -1095,9 +1219,18 @@ void gen_sfen(Position&, istringstream& is)
 		multi_think.random_multi_pv_depth = random_multi_pv_depth;
 		multi_think.write_minply = write_minply;
 		multi_think.write_maxply = write_maxply;
+		multi_think.filter_in_check = filter_in_check;
+		multi_think.filter_capture = filter_capture;
+		multi_think.filter_qsearch_margin = filter_qsearch_margin;
+		multi_think.states_per_thread = write_maxply + MAX_PLY;
 		multi_think.start_file_write_worker();
 		multi_think.go_think();
 
+		if (filter_in_check || filter_capture || filter_qsearch_margin >= 0)
+			cout << "positions skipped by the filters : in check = " << multi_think.rejected_in_check
+			     << " , capture or promotion = " << multi_think.rejected_capture
+			     << " , qsearch margin = " << multi_think.rejected_qsearch << endl;
+
 		// Since we are joining with the destructor of SfenWriter, please give a message that it has finished after the join
 		// Enclose this in a block because it should be displayed.
 	}
@@ -1282,6 +1415,23 @@ double calc_grad(Value shallow, const PackedSfenValue& psv) {
 	return calc_grad((Value)psv.score, shallow, psv);
 }
 
+#if defined(EVAL_NNUE)
+// Names of the objective functions for the loss option of the learn command, in the order of LossFunction
+const char* const LOSS_FUNCTION_NAMES[] = { "elmo", "winning_percentage", "cross_entropy", "cross_entropy_for_value" };
+
+// The NNUE training uses the objective function selected at compile time unless told otherwise
+constexpr LossFunction DEFAULT_LOSS_FUNCTION =
+#if defined(LOSS_FUNCTION_IS_WINNING_PERCENTAGE)
+	LossFunction::WinningPercentage;
+#elif defined(LOSS_FUNCTION_IS_CROSS_ENTOROPY)
+	LossFunction::CrossEntropy;
+#elif defined(LOSS_FUNCTION_IS_CROSS_ENTOROPY_FOR_VALUE)
+	LossFunction::CrossEntropyForValue;
+#else
+	LossFunction::ElmoMethod;
+#endif
+#endif
+
 // Sfen reader
 struct SfenReader
 {
@@ -1400,6 +1550,9 @@ struct SfenReader
 	{
 		while (true)
 		{
+			// The file worker sets end_of_files after handing out its last buffers,
+			// so look at it before the pool.
+			const bool no_more_files = end_of_files;
 			{
 				std::unique_lock<std::mutex> lk(mutex);
 				// If you can fill from the file buffer, that's fine.
@@ -1410,14 +1563,14 @@ struct SfenReader
 					packed_sfens[thread_id] = packed_sfens_pool.front();
 					packed_sfens_pool.pop_front();
 
-					total_read += THREAD_BUFFER_SIZE;
+					total_read += packed_sfens[thread_id]->size();
 
 					return true;
 				}
 			}
 
 			// The file to read is already gone. No more use.
-			if (end_of_files)
+			if (no_more_files)
 				return false;
 
 			// Waiting for file worker to fill packed_sfens_pool.
@@ -1433,6 +1586,28 @@ struct SfenReader
 		file_worker_thread = std::thread([&] { this->file_read_worker(); });
 	}
 
+	// Read the given files again once the previous ones are exhausted.
+	void restart_file_read_worker(const vector<string>& names)
+	{
+		if (file_worker_thread.joinable())
+			file_worker_thread.join();
+
+		// The files are read in reverse order.
+		filenames.assign(names.rbegin(), names.rend());
+		end_of_files = false;
+		start_file_read_worker();
+	}
+
+	// Whether some phases that were read from the files have not been used yet.
+	// Must not be called while the other threads read.
+	bool has_buffered_sfens()
+	{
+		std::unique_lock<std::mutex> lk(mutex);
+		return !end_of_files
+			|| !packed_sfens_pool.empty()
+			|| std::any_of(packed_sfens.begin(), packed_sfens.end(), [](PSVector* p) { return p && !p->empty(); });
+	}
+
 	// for file read-only threads
 	void file_read_worker()
 	{
@@ -1469,6 +1644,7 @@ struct SfenReader
 			sfens.reserve(SFEN_READ_SIZE);
 
 			// Read from the file into the file buffer.
+			bool last_files = false;
 			while (sfens.size() < SFEN_READ_SIZE)
 			{
 				PackedSfenValue p;
@@ -1480,10 +1656,10 @@ struct SfenReader
 					// read failure
 					if (!open_next_file())
 					{
-						// There was no next file. Abon.
+						// There was no next file. Hand out what was read so far.
 						cout << "..end of files." << endl;
-						end_of_files = true;
-						return;
+						last_files = true;
+						break;
 					}
 				}
 			}
@@ -1500,18 +1676,20 @@ struct SfenReader
 
 			// Divide this by THREAD_BUFFER_SIZE. There should be size pieces.
 			// SFEN_READ_SIZE shall be a multiple of THREAD_BUFFER_SIZE.
+			// The last read may be shorter, its last piece too.
 			assert((SFEN_READ_SIZE % THREAD_BUFFER_SIZE)==0);
 
-			auto size = size_t(SFEN_READ_SIZE / THREAD_BUFFER_SIZE);
+			auto size = size_t((sfens.size() + THREAD_BUFFER_SIZE - 1) / THREAD_BUFFER_SIZE);
 			std::vector<PSVector*> ptrs;
 			ptrs.reserve(size);
 
 			for (size_t i = 0; i < size; ++i)
 			{
 				// Delete this pointer on the receiving side.
+				const size_t count = std::min(THREAD_BUFFER_SIZE, sfens.size() - i * THREAD_BUFFER_SIZE);
 				PSVector* ptr = new PSVector();
-				ptr->resize(THREAD_BUFFER_SIZE);
-				memcpy(&((*ptr)[0]), &sfens[i * THREAD_BUFFER_SIZE], sizeof(PackedSfenValue) * THREAD_BUFFER_SIZE);
+				ptr->resize(count);
+				memcpy(&((*ptr)[0]), &sfens[i * THREAD_BUFFER_SIZE], sizeof(PackedSfenValue) * count);
 
 				ptrs.push_back(ptr);
 			}
@@ -1526,6 +1704,12 @@ struct SfenReader
 				for (size_t i = 0; i < size; ++i)
 					packed_sfens_pool.push_back(ptrs[i]);
 			}
+
+			if (last_files)
+			{
+				end_of_files = true;
+				return;
+			}
 		}
 	}
 
@@ -1683,6 +1867,20 @@ struct LearnerThink: public MultiThink
 	uint64_t loss_output_interval;
 	uint64_t mirror_percentage;
 
+#if defined(EVAL_NNUE)
+	// With the example cache, the passes over the training data after the first one
+	// are replayed from the cache, except every example_cache_refresh-th pass
+	// which reads the files again to refresh the qsearch() leaves.
+	vector<string> pass_filenames;
+	int passes_left = 0;
+	int pass = 0;
+	int example_cache_refresh = 0;
+	bool replaying = false;
+
+	// Start the next pass over the training data.
+	void next_pass();
+#endif
+
 	// Loss calculation.
 	// done: Number of phases targeted this time
 	void calc_loss(size_t thread_id , uint64_t done);
@@ -1743,18 +1941,13 @@ void LearnerThink::calc_loss(size_t thread_id, uint64_t done)
 	// It's better to parallelize here, but it's a bit troublesome because the search before slave has not finished.
 	// I created a mechanism to call task, so I will use it.
 
-	// The number of tasks to do.
-	atomic<int> task_count;
-	task_count = (int)sr.sfen_for_mse.size();
-	task_dispatcher.task_reserve(task_count);
-
 	// Create a task to search for the situation and give it to each thread.
 	for (const auto& ps : sr.sfen_for_mse)
 	{
 		// Assign work to each thread using TaskDispatcher.
 		// A task definition for that.
 		// It is not possible to capture pos used in ↑, so specify the variables you want to capture one by one.
-		auto task = [&ps,&test_sum_cross_entropy_eval,&test_sum_cross_entropy_win,&test_sum_cross_entropy,&test_sum_entropy_eval,&test_sum_entropy_win,&test_sum_entropy, &sum_norm,&task_count ,&move_accord_count](size_t thread_id)
+		auto task = [this,&ps,&test_sum_cross_entropy_eval,&test_sum_cross_entropy_win,&test_sum_cross_entropy,&test_sum_entropy_eval,&test_sum_entropy_win,&test_sum_entropy, &sum_norm,&move_accord_count](size_t thread_id)
 		{
 			// Does C++ properly capture a new ps instance for each loop?.
 			auto th = Threads[thread_id];
@@ -1776,7 +1969,7 @@ void LearnerThink::calc_loss(size_t thread_id, uint64_t done)
 			{
 				const auto rootColor = pos.side_to_move();
 				const auto pv = r.second;
-				std::vector<StateInfo,AlignedAllocator<StateInfo>> states(pv.size());
+				StateInfo* states = thread_states(thread_id);
 				for (size_t i = 0; i < pv.size(); ++i)
 				{
 					pos.do_move(pv[i], states[i]);
@@ -1830,21 +2023,14 @@ void LearnerThink::calc_loss(size_t thread_id, uint64_t done)
 				if ((uint16_t)r.second[0] == ps.move)
 					move_accord_count.fetch_add(1, std::memory_order_relaxed);
 			}
-
-			// Reduced one task because I did it
-			--task_count;
 		};
 
 		// Throw the defined task to slave.
 		task_dispatcher.push_task_async(task);
 	}
 
-	// join yourself as a slave
-	task_dispatcher.on_idle(thread_id);
-
-	// wait for all tasks to complete
-	while (task_count)
-		sleep(1);
+	// join yourself as a slave and wait for all tasks to complete
+	task_dispatcher.wait_tasks();
 
 #if !defined(LOSS_FUNCTION_IS_ELMO_METHOD)
 	// rmse = root mean square error: mean square error
@@ -1876,6 +2062,13 @@ void LearnerThink::calc_loss(size_t thread_id, uint64_t done)
 			<< " , test_entropy = "             << test_sum_entropy / sr.sfen_for_mse.size()
 			<< " , norm = "						<< sum_norm
 			<< " , move accuracy = "			<< (move_accord_count * 100.0 / sr.sfen_for_mse.size()) << "%";
+#if defined(EVAL_NNUE)
+		double learn_loss_sum;
+		uint64_t learn_loss_count;
+		Eval::NNUE::TakeTrainingLoss(&learn_loss_sum, &learn_loss_count);
+		if (learn_loss_count)
+			cout << " , learn_loss = " << learn_loss_sum / learn_loss_count;
+#else
 		if (done != static_cast<uint64_t>(-1))
 		{
 			cout
@@ -1886,6 +2079,7 @@ void LearnerThink::calc_loss(size_t thread_id, uint64_t done)
 				<< " , learn_cross_entropy = "      << learn_sum_cross_entropy / done
 				<< " , learn_entropy = "            << learn_sum_entropy / done;
 		}
+#endif
 		cout << endl;
 	}
 	else {
@@ -1905,12 +2099,31 @@ void LearnerThink::calc_loss(size_t thread_id, uint64_t done)
 }
 
 
-void LearnerThink::thread_worker(size_t thread_id)
+#if defined(EVAL_NNUE)
+void LearnerThink::next_pass()
 {
-#if defined(_OPENMP)
-	omp_set_num_threads((int)Options["Threads"]);
+	--passes_left;
+	++pass;
+
+	const bool refresh = example_cache_refresh > 0 && pass % example_cache_refresh == 0;
+
+	if (!refresh && Eval::NNUE::StartReplayingExamples())
+	{
+		replaying = true;
+		cout << "pass " << pass + 1 << " : replaying the example cache" << endl;
+	}
+	else
+	{
+		replaying = false;
+		Eval::NNUE::StartCachingExamples();
+		sr.restart_file_read_worker(pass_filenames);
+		cout << "pass " << pass + 1 << " : reading the training data" << endl;
+	}
+}
 #endif
 
+void LearnerThink::thread_worker(size_t thread_id)
+{
 	auto th = Threads[thread_id];
 	auto& pos = th->rootPos;
 
@@ -1999,7 +2212,12 @@ void LearnerThink::thread_worker(size_t thread_id)
 					uint64_t done = sr.total_done - sr.last_done;
 
 					// loss calculation
+					// The loss on the training data is not computed while replaying the example cache.
+#if defined(EVAL_NNUE)
+					calc_loss(thread_id , replaying ? static_cast<uint64_t>(-1) : done);
+#else
 					calc_loss(thread_id , done);
+#endif
 
 #if defined(EVAL_NNUE)
 					Eval::NNUE::CheckHealth();
@@ -2019,6 +2237,40 @@ void LearnerThink::thread_worker(size_t thread_id)
 
 		PackedSfenValue ps;
 	RetryRead:;
+#if defined(EVAL_NNUE)
+		// The examples of this pass are already computed.
+		if (replaying && Eval::NNUE::ReplayExample())
+		{
+			sr.total_done++;
+			continue;
+		}
+
+		if (replaying || !sr.read_to_thread_buffer(thread_id, ps))
+		{
+			if (passes_left == 0)
+			{
+				stop_flag = true;
+				break;
+			}
+
+			// Thread 0 starts the next pass once no other thread is still
+			// working on a position of this one.
+			if (read_lock.owns_lock())
+				read_lock.unlock();
+
+			if (thread_id == 0)
+			{
+				lock_guard<shared_timed_mutex> write_lock(nn_mutex);
+				if (replaying || !sr.has_buffered_sfens())
+					next_pass();
+			}
+			else if (stop_flag)
+				break;
+
+			sleep(1);
+			continue;
+		}
+#else
 		if (!sr.read_to_thread_buffer(thread_id, ps))
 		{
 			// ran out of thread pool for my thread.
@@ -2028,6 +2280,7 @@ void LearnerThink::thread_worker(size_t thread_id)
 			stop_flag = true;
 			break;
 		}
+#endif
 
 		// The evaluation value exceeds the learning target value.
 		// Ignore this aspect information.
@@ -2131,8 +2384,9 @@ void LearnerThink::thread_worker(size_t thread_id)
 
 			Value shallow_value = (rootColor == pos.side_to_move()) ? Eval::evaluate(pos) : -Eval::evaluate(pos);
 
-#if defined (LOSS_FUNCTION_IS_ELMO_METHOD)
+#if defined (LOSS_FUNCTION_IS_ELMO_METHOD) && !defined(EVAL_NNUE)
 			// Calculate loss for training data
+			// (The NNUE training computes it with the gradient of the mini-batch.)
 			double learn_cross_entropy_eval, learn_cross_entropy_win, learn_cross_entropy;
 			double learn_entropy_eval, learn_entropy_win, learn_entropy;
 			calc_cross_entropy(deep_value, shallow_value, ps, learn_cross_entropy_eval, learn_cross_entropy_win, learn_cross_entropy, learn_entropy_eval, learn_entropy_win, learn_entropy);
@@ -2167,7 +2421,7 @@ void LearnerThink::thread_worker(size_t thread_id)
 			sr.total_done++;
 		};
 
-		StateInfo state[MAX_PLY]; // PV of qsearch cannot be so long.
+		StateInfo* state = thread_states(thread_id); // PV of qsearch cannot be longer than MAX_PLY.
 		bool illegal_move = false;
 		for (auto m : pv)
 		{
@@ -2973,12 +3227,20 @@ void learn(Position&, istringstream& is)
 	double newbob_decay = 1.0;
 	int newbob_num_trials = 2;
 	string nn_options;
+	string loss_function_name = LOSS_FUNCTION_NAMES[int(DEFAULT_LOSS_FUNCTION)];
 #endif
 
 	uint64_t eval_save_interval = LEARN_EVAL_SAVE_INTERVAL;
 	uint64_t loss_output_interval = 0;
 	uint64_t mirror_percentage = 0;
 
+#if defined(EVAL_NNUE)
+	// Size in MB of the cache of the examples computed in the first pass over the training data,
+	// which are replayed in the following passes. 0 to read the training data at every pass.
+	uint64_t example_cache_size = 0;
+	int example_cache_refresh = 0;
+#endif
+
 	string validation_set_file_name;
 
 	// Assume the filenames are staggered.
@@ -3060,10 +3322,15 @@ void learn(Position&, istringstream& is)
 		else if (option == "newbob_decay") is >> newbob_decay;
 		else if (option == "newbob_num_trials") is >> newbob_num_trials;
 		else if (option == "nn_options") is >> nn_options;
+		else if (option == "loss") is >> loss_function_name;
 #endif
 		else if (option == "eval_save_interval") is >> eval_save_interval;
 		else if (option == "loss_output_interval") is >> loss_output_interval;
 		else if (option == "mirror_percentage") is >> mirror_percentage;
+#if defined(EVAL_NNUE)
+		else if (option == "example_cache_size") is >> example_cache_size;
+		else if (option == "example_cache_refresh") is >> example_cache_refresh;
+#endif
 		else if (option == "validation_set_file_name") is >> validation_set_file_name;
 
 		// Rabbit convert related
@@ -3199,7 +3466,19 @@ void learn(Position&, istringstream& is)
 	cout << "no_shuffle        : " << (no_shuffle ? "true" : "false") << endl;
 
 	// Insert the file name for the number of loops.
-	for (int i = 0; i < loop; ++i)
+	// With the example cache, the files are given to the reader again at every pass that reads them.
+	int file_loops = loop;
+#if defined(EVAL_NNUE)
+	if (example_cache_size)
+	{
+		for (auto& filename : filenames)
+			learn_think.pass_filenames.push_back(Path::Combine(base_dir, filename));
+		learn_think.passes_left = loop - 1;
+		learn_think.example_cache_refresh = example_cache_refresh;
+		file_loops = 1;
+	}
+#endif
+	for (int i = 0; i < file_loops; ++i)
 		// sfen reader, I'll read it in reverse order so I'll reverse it here. I'm sorry.
 		for (auto it = filenames.rbegin(); it != filenames.rend(); ++it)
 			sr.filenames.push_back(Path::Combine(base_dir, *it));
@@ -3207,7 +3486,18 @@ void learn(Position&, istringstream& is)
 #if !defined(EVAL_NNUE)
 	cout << "Gradient Method   : " << LEARN_UPDATE      << endl;
 #endif
+#if defined(EVAL_NNUE)
+	auto loss_function_it = std::find(std::begin(LOSS_FUNCTION_NAMES), std::end(LOSS_FUNCTION_NAMES), loss_function_name);
+	if (loss_function_it == std::end(LOSS_FUNCTION_NAMES))
+	{
+		cout << "Error! : unknown loss function " << loss_function_name << endl;
+		return;
+	}
+	const auto loss_function = LossFunction(loss_function_it - std::begin(LOSS_FUNCTION_NAMES));
+	cout << "Loss Function     : " << loss_function_name << endl;
+#else
 	cout << "Loss Function     : " << LOSS_FUNCTION     << endl;
+#endif
 	cout << "mini-batch size   : " << mini_batch_size   << endl;
 #if defined(EVAL_NNUE)
 	cout << "nn_batch_size     : " << nn_batch_size     << endl;
@@ -3235,6 +3525,10 @@ void learn(Position&, istringstream& is)
 	cout << "LAMBDA_LIMIT      : " << ELMO_LAMBDA_LIMIT << endl;
 #endif
 	cout << "mirror_percentage : " << mirror_percentage << endl;
+#if defined(EVAL_NNUE)
+	cout << "example_cache_size: " << example_cache_size << " MB" << endl;
+	cout << "example_cache_refresh : " << example_cache_refresh << endl;
+#endif
 	cout << "eval_save_interval  : " << eval_save_interval << " sfens" << endl;
 	cout << "loss_output_interval: " << loss_output_interval << " sfens" << endl;
 
@@ -3265,6 +3559,12 @@ void learn(Position&, istringstream& is)
 	Eval::NNUE::InitializeTraining(eta1,eta1_epoch,eta2,eta2_epoch,eta3);
 	Eval::NNUE::SetBatchSize(nn_batch_size);
 	Eval::NNUE::SetOptions(nn_options);
+	Eval::NNUE::SetExampleCacheSize(example_cache_size);
+#if defined (LOSS_FUNCTION_IS_ELMO_METHOD)
+	Eval::NNUE::SetLossFunction(loss_function, ELMO_LAMBDA, ELMO_LAMBDA2, ELMO_LAMBDA_LIMIT);
+#else
+	Eval::NNUE::SetLossFunction(loss_function, 0.33, 0.33, 32000);
+#endif
 	if (newbob_decay != 1.0 && !Options["SkipLoadingEval"]) {
 		learn_think.best_nn_directory = std::string(Options["EvalDir"]);
 	}
@@ -3317,6 +3617,7 @@ void learn(Position&, istringstream& is)
 	// sr.calc_rmse();
 #if defined(EVAL_NNUE)
 	if (newbob_decay != 1.0) {
+		learn_think.alloc_thread_states();
 		learn_think.calc_loss(0, -1);
 		learn_think.best_loss = learn_think.latest_loss_sum / learn_think.latest_loss_count;
 		learn_think.latest_loss_sum = 0.0;
@@ -2,10 +2,8 @@
 
 #if defined (EVAL_LEARN)
 
-#if defined(_OPENMP)
-#include <omp.h>
-#endif
 #include "../misc.h"
+#include "../task_pool.h"
 
 using namespace Eval;
 
@@ -43,23 +41,12 @@ namespace EvalLearningTools
 		uint64_t size = g_kpp.max_index();
 		min_index_flag.resize(size);
 
-#pragma omp parallel
+		// Split the work over the task pool. (The workers are assigned to the CPUs by the pool.)
+		// The chunk size is a multiple of 64 so that two tasks never write to the same word of the vector<bool>.
+		Tasks.parallel_for(0, size, 20480, [&](size_t first, size_t last)
 		{
-#if defined(_OPENMP)
-			// To prevent the logical 64 cores from being used when there are two CPUs under Windows
-			// explicitly assign to CPU here
-			int thread_index = omp_get_thread_num(); // get your thread number
-			WinProcGroup::bindThisThread(thread_index);
-#endif
-
-#pragma omp for schedule(dynamic,20000)
-
-			for (int64_t index_ = 0; index_ < (int64_t)size; ++index_)
+			for (uint64_t index = first; index < last; ++index)
 			{
-				// It seems that the loop variable must be a sign type due to OpenMP restrictions, but
-				// It's really difficult to use.
-				uint64_t index = (uint64_t)index_;
-
 				if (g_kk.is_ok(index))
 				{
 					// Make sure that the original index will be restored by conversion from index and reverse conversion.
@@ -112,7 +99,7 @@ namespace EvalLearningTools
 					assert(false);
 				}
 			}
-		}
+		});
 	}
 
 	void learning_tools_unit_test_kpp()
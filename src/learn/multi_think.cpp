@@ -6,7 +6,7 @@
 #include "../tt.h"
 #include "../uci.h"
 
-#include <thread>
+#include <chrono>
 
 void MultiThink::go_think()
 {
@@ -25,89 +25,36 @@ void MultiThink::go_think()
 	// Call the derived class's init().
 	init();
 
+	alloc_thread_states();
+
 	// The loop upper limit is set with set_loop_max().
 	loop_count = 0;
 	done_count = 0;
 
-	// Create threads as many as Options["Threads"] and start thinking.
-	std::vector<std::thread> threads;
-	auto thread_num = (size_t)Options["Threads"];
+	// Run thread_worker() on as many task pool workers as Options["Threads"] and start thinking.
+	// The pool is sized by Options["Threads"], and each job is pinned to its worker
+	// so that thread_id is also the index of the search thread in Threads[].
+	auto thread_num = std::min((size_t)Options["Threads"], Tasks.size());
 
-	// Secure end flag of worker thread
-	thread_finished.resize(thread_num);
-	
-	// start worker thread
+	TaskPool::Group workers;
 	for (size_t i = 0; i < thread_num; ++i)
-	{
-		thread_finished[i] = 0;
-		threads.push_back(std::thread([i, this]
-		{ 
-			// exhaust all processor threads.
-			WinProcGroup::bindThisThread(i);
-
-			// execute the overridden process
-			this->thread_worker(i);
-
-			// Set the end flag because the thread has ended
-			this->thread_finished[i] = 1;
-		}));
-	}
-
-	// wait for all threads to finish
-	// for (auto& th :threads)
-	// th.join();
-	// If you write like, the thread will rush here while it is still working,
-	// During that time, callback_func() cannot be called and you cannot save.
-	// Therefore, you need to check the end flag yourself.
-
-	// function to determine if all threads have finished
-	auto threads_done = [&]()
-	{
-		// returns false if no one is finished
-		for (auto& f : thread_finished)
-			if (!f)
-				return false;
-		return true;
-	};
-
-	// Call back if the callback function is set.
-	auto do_a_callback = [&]()
-	{
+		Tasks.submit_to(i, workers, [this](size_t thread_id) { this->thread_worker(thread_id); });
+
+	// Wait for all workers to finish. Waking up only on completion or every callback_seconds
+	// means callback_func() can still save periodically while they are working.
+	// Since the timeout restarts after the callback returns,
+	// no matter how long it takes to save() etc. in callback_func()
+	// The next call will take a certain amount of time.
+	while (!Tasks.wait_for(workers, std::chrono::seconds(callback_seconds)))
 		if (callback_func)
 			callback_func();
-	};
-
-
-	for (uint64_t i = 0 ; ; )
-	{
-		// If all threads have finished, exit the loop.
-		if (threads_done())
-			break;
-
-		sleep(1000);
-
-		// callback_func() is called every callback_seconds.
-		if (++i == callback_seconds)
-		{
-			do_a_callback();
-			// Since I am returning from ↑, I reset the counter, so
-			// no matter how long it takes to save() etc. in do_a_callback()
-			// The next call will take a certain amount of time.
-			i = 0;
-		}
-	}
 
 	// Last save.
 	std::cout << std::endl << "finalize..";
 
-	// do_a_callback();
+	// callback_func();
 	// → It should be saved by the caller, so I feel that it is not necessary here.
 
-	// It is possible that the exit code of the thread is running but the exit code of the thread is running, so
-	// We need to wait for the end with join().
-	for (auto& th : threads)
-		th.join();
-
 	// The file writing thread etc. are still running only when all threads are finished
 	// Since the work itself may not have completed, output only that all threads have finished.
 	std::cout << "all threads are joined." << std::endl;
@@ -119,5 +66,13 @@ void MultiThink::go_think()
 
 }
 
+void MultiThink::alloc_thread_states()
+{
+	// Tasks may run on any worker of the pool, not only on the ones running thread_worker().
+	states_buffers.resize(Tasks.size());
+	for (auto& states : states_buffers)
+		states.resize(states_per_thread);
+}
+
 
 #endif // defined(EVAL_LEARN)
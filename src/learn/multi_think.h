@@ -8,7 +8,7 @@
 
 #include "../misc.h"
 #include "../learn/learn.h"
-#include "../thread_win32_osx.h"
+#include "../task_pool.h"
 
 #include <atomic>
 
@@ -76,11 +76,26 @@ struct MultiThink
 	// Mutex when worker thread accesses I/O
 	std::mutex io_mutex;
 
+	// Number of StateInfo in the buffer of each thread. It must cover the longest line a worker replays,
+	// set it before go_think() if MAX_PLY is not enough.
+	size_t states_per_thread = MAX_PLY;
+
+	// Allocate the StateInfo buffers of the threads. go_think() does it,
+	// call it before using the buffers outside of go_think().
+	void alloc_thread_states();
+
+	// StateInfo buffer of the thread, to replay a line without allocating.
+	// It is reused for every position and game, and is also the one of the thread when it runs a task.
+	StateInfo* thread_states(size_t thread_id) { return states_buffers[thread_id].data(); }
+
 protected:
 	// Random number generator body
 	AsyncPRNG prng;
 
 private:
+	// StateInfo buffers of the threads, indexed by thread_id
+	std::vector<std::vector<StateInfo, AlignedAllocator<StateInfo>>> states_buffers;
+
 	// number of times worker processes (calls Search::think())
 	std::atomic<uint64_t> loop_max;
 	// number of times the worker has processed (calls Search::think())
@@ -90,62 +105,39 @@ private:
 
 	// Mutex when changing the variables in ↑
 	std::mutex loop_mutex;
-
-	// Thread end flag.
-	// vector<bool> may not be reflected properly when trying to rewrite from multiple threads...
-	typedef uint8_t Flag;
-	std::vector<Flag> thread_finished;
-
 };
 
 // Mechanism to process task during idle time.
 // master passes the task with push_task_async() whenever you like.
-// When slave executes on_idle() in its spare time, it retrieves one task and continues execution until there is no queue.
+// When slave executes on_idle() in its spare time, it executes the queued tasks of the task pool.
 // Convenient to use when you want to write MultiThink thread worker in master-slave method.
+// Tasks are run on the pool workers, so thread_id passed to a task is the index of the worker (= Threads[] index).
 struct TaskDispatcher
 {
-	typedef std::function<void(size_t /* thread_id */)> Task;
+	typedef TaskPool::Task Task;
 
 	// slave calls this function during idle.
+	// After running the queued tasks, wait a little for new ones so that the caller can check its own state again.
 	void on_idle(size_t thread_id)
 	{
-		Task task;
-		while ((task = get_task_async()) != nullptr)
-			task(thread_id);
-
-		sleep(1);
+		Tasks.idle(thread_id, 1);
 	}
 
 	// Stack [ASYNC] task.
 	void push_task_async(Task task)
 	{
-		std::unique_lock<std::mutex> lk(task_mutex);
-		tasks.push_back(task);
+		Tasks.submit(tasks, std::move(task));
 	}
 
-	// Allocate size array elements for task in advance.
-	void task_reserve(size_t size)
+	// Wait until all the pushed tasks are complete. A pool worker executes tasks itself while waiting.
+	void wait_tasks()
 	{
-		tasks.reserve(size);
+		Tasks.wait(tasks);
 	}
 
 protected:
-	// set of tasks
-	std::vector<Task> tasks;
-
-	// Take out one [ASYNC] task. Called from on_idle().
-	Task get_task_async()
-	{
-		std::unique_lock<std::mutex> lk(task_mutex);
-		if (tasks.size() == 0)
-			return nullptr;
-		Task task = *tasks.rbegin();
-		tasks.pop_back();
-		return task;
-	}
-
-	// a mutex for accessing tasks
-	std::mutex task_mutex;
+	// tasks pushed and not yet completed
+	TaskPool::Group tasks;
 };
 
 #endif // defined(EVAL_LEARN) && defined(YANEURAOU_2018_OTAFUKU_ENGINE)
@@ -0,0 +1,512 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2020 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>   // For std::memset
+#include <iostream>
+#include <unordered_set>
+
+#include "mate_search.h"
+#include "misc.h"
+#include "movegen.h"
+#include "position.h"
+#include "task_pool.h"
+#include "thread.h"
+#include "timeman.h"
+#include "uci.h"
+
+using Search::Limits;
+
+namespace {
+
+  // Proof and disproof numbers saturate at Infinite, so that they fit in 28 bits
+  constexpr uint32_t Infinite = (1 << 28) - 1;
+
+  // Proof trees larger than this are not counted to the end
+  constexpr size_t MaxProofSize = 1 << 20;
+
+  // Node holds the proof number (the least number of positions still to be
+  // proven for a mate) and the disproof number (the same for a refutation).
+  struct Node {
+    uint32_t pn, dn;
+  };
+
+  constexpr Node Proven    = { 0, Infinite };
+  constexpr Node Disproven = { Infinite, 0 };
+  constexpr Node Unknown   = { 1, 1 };
+
+  // Entry stores the numbers of a position searched with a given number of
+  // plies left. The data is xored into the check word, so that a torn write
+  // by another thread reads back as a different key.
+  struct Entry {
+    std::atomic<uint64_t> check, data;
+  };
+
+  Entry* Table;
+  void* TableMem;
+  size_t Mask;
+  std::atomic<bool> Solved, LimitReached;
+  uint64_t ProofSize;
+
+  // Without a mate, the regular search picks the best move. Unless 'go' limits
+  // it otherwise, it searches as many plies as the mate search, up to this depth.
+  constexpr int FallbackDepth = 16;
+
+  uint64_t pack(Node n, int depth) {
+    return uint64_t(n.pn) << 36 | uint64_t(n.dn) << 8 | uint64_t(depth);
+  }
+
+  Node unpack(uint64_t data) {
+    return { uint32_t(data >> 36), uint32_t(data >> 8) & Infinite };
+  }
+
+  // read() returns false if the entry of the key holds another position
+  bool read(Key key, Node& n, int& depth) {
+
+    const Entry& e = Table[key & Mask];
+    const uint64_t data = e.data.load(std::memory_order_relaxed);
+
+    if ((e.check.load(std::memory_order_relaxed) ^ data) != key)
+        return false;
+
+    n = unpack(data);
+    depth = int(data & 0xFF);
+    return true;
+  }
+
+  // probe() returns the numbers of a position with depth plies left. A mate
+  // proven with fewer plies and a refutation with more plies hold as well.
+  Node probe(Key key, int depth) {
+
+    Node n;
+    int d;
+
+    if (!read(key, n, d))
+        return Unknown;
+
+    return  n.pn == 0 && d <= depth ? Proven
+          : n.dn == 0 && d >= depth ? Disproven
+          : d == depth              ? n
+                                    : Unknown;
+  }
+
+  // store() saves the numbers of a position, unless the entry already holds a
+  // result of the same kind that is valid for more depths.
+  void store(Key key, int depth, Node n) {
+
+    Entry& e = Table[key & Mask];
+    Node old;
+    int d;
+
+    if (   read(key, old, d)
+        && ((old.pn == 0 && n.pn == 0 && d <= depth) || (old.dn == 0 && n.dn == 0 && d >= depth)))
+        return;
+
+    const uint64_t data = pack(n, depth);
+    e.check.store(key ^ data, std::memory_order_relaxed);
+    e.data.store(data, std::memory_order_relaxed);
+  }
+
+  // rule50_key() is hashed into the key of a position whose result may depend
+  // on the fifty-move rule.
+  Key rule50_key(const Position& pos) {
+    return Key(pos.rule50_count() + 1) * 0x9E3779B97F4A7C15ULL;
+  }
+
+  // table_key() returns the key of a position searched with depth plies left.
+  // The fifty-move rule can only end the game within these plies if the
+  // counter is high enough, and only then the counter is part of the key.
+  Key table_key(const Position& pos, int depth) {
+    return pos.rule50_count() + depth < 100 ? pos.key() : pos.key() ^ rule50_key(pos);
+  }
+
+  // proof_depth() returns the plies left with which the position following
+  // move m has been proven a mate, or -1 if the table has no such proof.
+  int proof_depth(Position& pos, Move m, int depth) {
+
+    StateInfo st;
+    Node n;
+    int d;
+
+    pos.do_move(m, st);
+    bool found =   (read(pos.key() ^ rule50_key(pos), n, d) && n.pn == 0 && d <= depth)
+                || (   read(pos.key(), n, d) && n.pn == 0 && d <= depth
+                    && pos.rule50_count() + d < 100);
+    pos.undo_move(m);
+
+    return found ? d : -1;
+  }
+
+  // generate() writes the moves to search to the list and returns their number.
+  // With a single ply left only the checks of the attacker can mate.
+  int generate(const Position& pos, int depth, bool attacker, Move* list) {
+
+    int n = 0;
+
+    for (const auto& m : MoveList<LEGAL>(pos))
+        if (!attacker || depth > 1 || pos.gives_check(m))
+            list[n++] = m;
+
+    return n;
+  }
+
+  // proof_move() returns the move that the proof follows: the quickest mate
+  // for the attacker and the longest defence for the defender.
+  Move proof_move(Position& pos, int depth, bool attacker) {
+
+    Move moves[MAX_MOVES], best = MOVE_NONE;
+    int bestDepth = attacker ? depth : -1;
+
+    for (int i = 0, n = generate(pos, depth, attacker, moves); i < n; ++i)
+    {
+        int d = proof_depth(pos, moves[i], depth - 1);
+
+        if (d >= 0 && (attacker ? d < bestDepth : d > bestDepth))
+            best = moves[i], bestDepth = d;
+    }
+
+    return best;
+  }
+
+  // extract_pv() appends the moves of the proof to the PV, as long as the
+  // table still holds them.
+  void extract_pv(Position& pos, int depth, bool attacker, std::vector<Move>& pv) {
+
+    StateInfo st;
+    Move m;
+
+    if (!depth || (m = proof_move(pos, depth, attacker)) == MOVE_NONE)
+        return;
+
+    pv.push_back(m);
+    pos.do_move(m, st);
+    extract_pv(pos, depth - 1, !attacker, pv);
+    pos.undo_move(m);
+  }
+
+  // count_proof() collects the positions of the proof tree: one move of the
+  // attacker and all the moves of the defender.
+  void count_proof(Position& pos, int depth, bool attacker, std::unordered_set<Key>& seen) {
+
+    if (!seen.insert(pos.key()).second || seen.size() >= MaxProofSize || !depth)
+        return;
+
+    Move moves[MAX_MOVES];
+    StateInfo st;
+    int n = attacker ? 0 : generate(pos, depth, attacker, moves);
+
+    if (attacker && (moves[0] = proof_move(pos, depth, attacker)) != MOVE_NONE)
+        n = 1;
+
+    for (int i = 0; i < n; ++i)
+    {
+        pos.do_move(moves[i], st);
+        count_proof(pos, depth - 1, !attacker, seen);
+        pos.undo_move(moves[i]);
+    }
+  }
+
+  // Solver is the df-pn search of one worker
+  struct Solver {
+    Node mid(Position& pos, int depth, int ply, Node th, bool attacker);
+    bool stopped();
+
+    int calls = 0;
+  };
+
+  // Solver::stopped() checks the limits of the 'go' command every 1024 calls,
+  // like MainThread::check_time() does for the regular search.
+  bool Solver::stopped() {
+
+    if (++calls % 1024 == 0 && !Threads.main()->ponder)
+    {
+        const TimePoint elapsed = Time.elapsed();
+
+        if (   (Limits.use_time_management() && elapsed > Time.maximum() - 10)
+            || (Limits.movetime && elapsed >= Limits.movetime)
+            || (Limits.nodes && Threads.nodes_searched() >= uint64_t(Limits.nodes)))
+            LimitReached = Threads.stop = true;
+    }
+
+    return Solved || Threads.stop;
+  }
+
+  // Solver::mid() expands the position with depth plies left, ply plies from
+  // the root, until its proof or disproof number reaches the threshold th,
+  // always descending into the most proving child. The attacker's nodes are
+  // OR nodes: their proof number is the minimum of the children, their
+  // disproof number the sum. Defender's nodes are AND nodes, the other way round.
+  Node Solver::mid(Position& pos, int depth, int ply, Node th, bool attacker) {
+
+    Move moves[MAX_MOVES];
+    Key keys[MAX_MOVES];
+    Node children[MAX_MOVES];
+    StateInfo st;
+
+    // A draw by the fifty-move rule or by repetition refutes the mate. It
+    // depends on the path, so it is not stored.
+    if (pos.is_draw(ply))
+        return Disproven;
+
+    const int n = generate(pos, depth, attacker, moves);
+    const Key key = table_key(pos, depth);
+
+    // Checkmate, stalemate, or the attacker is out of moves
+    if (!n || (!attacker && !depth))
+    {
+        Node result = !attacker && !n && pos.checkers() ? Proven : Disproven;
+        store(key, depth, result);
+        return result;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        pos.do_move(moves[i], st);
+        keys[i] = table_key(pos, depth - 1);
+        const bool draw = pos.is_draw(ply + 1);
+        pos.undo_move(moves[i]);
+        children[i] = draw ? Disproven : probe(keys[i], depth - 1);
+    }
+
+    while (true)
+    {
+        uint32_t best = Infinite, second = Infinite, sum = 0;
+        int bestIdx = 0;
+
+        for (int i = 0; i < n; ++i)
+        {
+            const uint32_t m = attacker ? children[i].pn : children[i].dn;
+            const uint32_t s = attacker ? children[i].dn : children[i].pn;
+
+            sum = std::min(sum + s, Infinite);
+
+            if (m < best)
+                second = best, best = m, bestIdx = i;
+            else if (m < second)
+                second = m;
+        }
+
+        const Node node = attacker ? Node{ best, sum } : Node{ sum, best };
+
+        if (node.pn >= th.pn || node.dn >= th.dn || stopped())
+        {
+            store(key, depth, node);
+            return node;
+        }
+
+        // The child may work until it is no longer the most proving one, or
+        // until the other numbers reach the threshold of the node.
+        const Node& c = children[bestIdx];
+        const Node childTh = attacker ? Node{ std::min(th.pn, second + 1), th.dn - node.dn + c.dn }
+                                      : Node{ th.pn - node.pn + c.pn, std::min(th.dn, second + 1) };
+
+        pos.do_move(moves[bestIdx], st);
+        children[bestIdx] = mid(pos, depth - 1, ply + 1, childTh, !attacker);
+        pos.undo_move(moves[bestIdx]);
+    }
+  }
+
+  // allocate() replaces the table with an empty one of the given size
+  void allocate(size_t mbSize) {
+
+    aligned_ttmem_free(TableMem);
+
+    size_t count = 1;
+    while (2 * count * sizeof(Entry) <= mbSize * 1024 * 1024)
+        count *= 2;
+
+    Table = static_cast<Entry*>(aligned_ttmem_alloc(count * sizeof(Entry), TableMem));
+    if (!TableMem)
+    {
+        std::cerr << "Failed to allocate " << mbSize
+                  << "MB for the mate search table." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    Mask = count - 1;
+    MateSearch::clear();
+  }
+
+} // namespace
+
+
+/// MateSearch::resize() sets the size of the table in megabytes. The table is
+/// allocated by the first search if the size is never set.
+
+void MateSearch::resize(size_t mbSize) {
+
+  Threads.main()->wait_for_search_finished();
+
+  allocate(mbSize);
+}
+
+
+/// MateSearch::clear() empties the table, if it has been allocated
+
+void MateSearch::clear() {
+
+  if (!Table)
+      return;
+
+  Tasks.parallel_for(0, Mask + 1, 0, [](size_t first, size_t last) {
+      std::memset(static_cast<void*>(&Table[first]), 0, (last - first) * sizeof(Entry));
+  });
+}
+
+
+/// MateSearch::search() looks for the shortest mate in at most Limits.mate
+/// moves, trying one more move at every iteration. Within an iteration the
+/// workers of the task pool take the root moves in turn, checks first, and
+/// try to prove them; the first proof ends the search. The proven move and
+/// its line are stored in the root moves of the main thread. Returns false if
+/// no mate is proven, the regular search then picks the move: within the limits
+/// of 'go', or with a single iteration if the mate search has used them up.
+
+bool MateSearch::search(MainThread* th) {
+
+  if (!Table)
+      allocate(size_t(Options["MateHash"]));
+
+  Position& rootPos = th->rootPos;
+  Search::RootMoves& rootMoves = th->rootMoves;
+  const std::string fen = rootPos.fen();
+  const int maxMate = std::min(Limits.mate, MAX_PLY / 2);
+
+  ProofSize = 0;
+  LimitReached = false;
+
+  // Most forcing moves first: checks, then captures. The regular search gets
+  // the moves back in their own order if there is no mate.
+  const Search::RootMoves rootOrder = rootMoves;
+  auto priority = [&](const Search::RootMove& rm) {
+      return rootPos.gives_check(rm.pv[0]) ? 0 : rootPos.capture(rm.pv[0]) ? 1 : 2;
+  };
+  std::stable_sort(rootMoves.begin(), rootMoves.end(),
+                   [&](const Search::RootMove& a, const Search::RootMove& b) {
+                       return priority(a) < priority(b);
+                   });
+
+  for (int mate = 1; mate <= maxMate && !Threads.stop; ++mate)
+  {
+      const int depth = 2 * mate - 1;
+      const size_t NoMove = rootMoves.size();
+      std::atomic<size_t> next(0), proven(NoMove);
+
+      Solved = false;
+
+      Tasks.parallel_for(0, std::max(Tasks.size(), size_t(1)), 1, [&](size_t, size_t) {
+
+          StateInfo rootSt, st;
+          Position pos;
+          Solver solver;
+          size_t i;
+
+          // The pool has one worker per search thread, and the search threads
+          // idle meanwhile, so each worker counts its nodes in the counters of
+          // the thread of its index. They are written by one thread only.
+          const size_t w = TaskPool::worker_index();
+          Thread* owner = w < Threads.size() ? Threads[w] : th;
+
+          pos.set(fen, rootPos.is_chess960(), &rootSt, owner);
+
+          while ((i = next++) < rootMoves.size() && !solver.stopped())
+          {
+              Move m = rootMoves[i].pv[0];
+
+              pos.do_move(m, st);
+              Node n = solver.mid(pos, depth - 1, 1, { Infinite, Infinite }, false);
+              pos.undo_move(m);
+
+              size_t none = NoMove;
+              if (n.pn == 0 && proven.compare_exchange_strong(none, i))
+                  Solved = true;
+          }
+      });
+
+      const TimePoint elapsed = Time.elapsed() + 1;
+      const uint64_t nodes = Threads.nodes_searched();
+
+      if (proven == NoMove)
+      {
+          sync_cout << "info depth " << depth
+                    << " nodes " << nodes
+                    << " nps "   << nodes * 1000 / elapsed
+                    << " time "  << elapsed << sync_endl;
+          continue;
+      }
+
+      std::rotate(rootMoves.begin(), rootMoves.begin() + proven, rootMoves.begin() + proven + 1);
+
+      Search::RootMove& rm = rootMoves[0];
+      StateInfo st;
+      std::unordered_set<Key> seen;
+
+      rm.pv.resize(1);
+      rootPos.do_move(rm.pv[0], st);
+      extract_pv(rootPos, depth - 1, false, rm.pv);
+      count_proof(rootPos, depth - 1, false, seen);
+      rootPos.undo_move(rm.pv[0]);
+
+      rm.score = mate_in(depth);
+      rm.selDepth = int(rm.pv.size());
+      th->completedDepth = depth;
+      ProofSize = seen.size() + 1;
+
+      sync_cout << "info depth " << depth
+                << " seldepth "  << rm.selDepth
+                << " score "     << UCI::value(rm.score)
+                << " nodes "     << nodes
+                << " nps "       << nodes * 1000 / elapsed
+                << " time "      << elapsed
+                << " pv";
+
+      for (Move m : rm.pv)
+          std::cout << " " << UCI::move(m, rootPos.is_chess960());
+
+      std::cout << "\ninfo string proof size " << ProofSize << sync_endl;
+      return true;
+  }
+
+  rootMoves = rootOrder;
+
+  if (!Threads.stop)
+  {
+      sync_cout << "info string No mate in " << maxMate << " found" << sync_endl;
+
+      if (!Limits.use_time_management() && !Limits.movetime && !Limits.nodes && !Limits.depth)
+          Limits.depth = std::min(2 * maxMate, FallbackDepth);
+  }
+  else if (LimitReached)
+  {
+      Threads.stop = false;
+      Limits.depth = 1;
+  }
+
+  return false;
+}
+
+
+/// MateSearch::proof_size() returns the number of positions in the proof tree
+/// of the last search, 0 if it found no mate.
+
+uint64_t MateSearch::proof_size() {
+  return ProofSize;
+}
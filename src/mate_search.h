@@ -0,0 +1,44 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2020 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MATE_SEARCH_H_INCLUDED
+#define MATE_SEARCH_H_INCLUDED
+
+#include <cstdint>
+#include <cstddef>
+
+struct MainThread;
+
+/// MateSearch is a depth-first proof-number (df-pn) solver that answers
+/// 'go mate N' instead of the alpha-beta search when the MateSolver option is
+/// set. It proves or disproves a forced mate for the side to move within N
+/// moves, with a table of its own sized by the MateHash option. The root moves
+/// are shared among the workers of the task pool.
+
+namespace MateSearch {
+
+void resize(size_t mbSize);
+void clear();
+bool search(MainThread* th);
+uint64_t proof_size();
+
+} // namespace MateSearch
+
+#endif // #ifndef MATE_SEARCH_H_INCLUDED
@@ -53,6 +53,16 @@ typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 #include <sys/mman.h>
 #endif
 
+#if (defined(__linux__) && !defined(__ANDROID__)) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define USE_POSIX_SHM
+#endif
+
+#include "bitboard.h"
 #include "misc.h"
 #include "thread.h"
 
@@ -221,6 +231,12 @@ const std::string compiler_info() {
   #endif
   compiler += "\n";
 
+  #if defined(USE_PEXT)
+     compiler += " Sliding attacks looked up with ";
+     compiler += Bitboards::uses_pext() ? "pext" : "magic multiplication";
+     compiler += "\n";
+  #endif
+
   return compiler;
 }
 
@@ -418,6 +434,164 @@ void aligned_ttmem_free(void *mem) {
 #endif
 
 
+/// shared_mem_open() maps the named shared memory segment, creating it with the
+/// given size if it does not exist yet. On return size is the size of the
+/// mapping and created tells whether the segment is new, in which case it is
+/// zero filled. lock identifies the process' use of the segment, to be passed
+/// to shared_mem_close(). Returns nullptr if the segment can not be mapped or
+/// if shared memory is not supported on this platform.
+///
+/// On POSIX systems every process holds a shared flock() on the segment while
+/// it uses it. The kernel drops the lock when the process exits, even when it
+/// is killed, so a segment nobody holds a lock on is a leftover of processes
+/// that died: it is removed and a new one created.
+
+#if defined(USE_POSIX_SHM)
+
+void* shared_mem_open(const std::string& name, size_t& size, bool& created, int& lock) {
+
+  const std::string path = name[0] == '/' ? name : "/" + name;
+  const size_t requested = size;
+
+  for (int attempt = 0; attempt < 3; ++attempt)
+  {
+      size = requested;
+      int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+      created = fd != -1;
+
+      if (created)
+      {
+          flock(fd, LOCK_SH);
+
+          if (ftruncate(fd, off_t(size)))
+          {
+              close(fd);
+              shm_unlink(path.c_str());
+              return nullptr;
+          }
+      }
+      else
+      {
+          fd = shm_open(path.c_str(), O_RDWR, 0600);
+          if (fd == -1)
+              return nullptr;
+
+          // Nobody uses the segment. Where shared memory can not be locked,
+          // flock() always fails and segments are never removed.
+          if (!flock(fd, LOCK_EX | LOCK_NB))
+          {
+              close(fd);
+              shm_unlink(path.c_str());
+              continue;
+          }
+
+          flock(fd, LOCK_SH);
+      }
+
+      // Another process may have removed the segment before we got the lock,
+      // taking it for a leftover or releasing it as its last user.
+      struct stat st;
+      if (fstat(fd, &st) || st.st_nlink == 0)
+      {
+          close(fd);
+          continue;
+      }
+
+      if (!created)
+      {
+          // The process that created the segment may not have sized it yet
+          for (int i = 0; i < 100 && !fstat(fd, &st) && st.st_size == 0; ++i)
+              sleep(10);
+
+          if (fstat(fd, &st) || st.st_size == 0)
+          {
+              close(fd);
+              return nullptr;
+          }
+          size = size_t(st.st_size);
+      }
+
+      void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+      if (mem == MAP_FAILED)
+      {
+          close(fd);
+          return nullptr;
+      }
+
+#if defined(MADV_HUGEPAGE)
+      madvise(mem, size, MADV_HUGEPAGE);
+#endif
+
+      lock = fd; // Kept open for the lock
+      return mem;
+  }
+
+  return nullptr;
+}
+
+/// shared_mem_close() unmaps the segment and removes it if no other process
+/// uses it anymore.
+
+void shared_mem_close(const std::string& name, void* mem, size_t size, int lock) {
+
+  if (!mem)
+      return;
+
+  munmap(mem, size);
+
+  if (!flock(lock, LOCK_EX | LOCK_NB))
+      shm_unlink((name[0] == '/' ? name : "/" + name).c_str());
+
+  close(lock);
+}
+
+#elif defined(_WIN32)
+
+void* shared_mem_open(const std::string& name, size_t& size, bool& created, int& lock) {
+
+  lock = -1;
+
+  HANDLE h = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                DWORD(uint64_t(size) >> 32), DWORD(size & 0xFFFFFFFF),
+                                name.c_str());
+  if (!h)
+      return nullptr;
+
+  created = GetLastError() != ERROR_ALREADY_EXISTS;
+
+  // Map the whole section, which may be larger than requested if it exists already
+  void* mem = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  CloseHandle(h); // The view keeps the section alive
+
+  MEMORY_BASIC_INFORMATION mbi;
+  if (mem && !created && VirtualQuery(mem, &mbi, sizeof(mbi)))
+      size = mbi.RegionSize;
+
+  return mem;
+}
+
+// The section is destroyed with its last view, also when a process dies
+void shared_mem_close(const std::string&, void* mem, size_t, int) {
+
+  if (mem)
+      UnmapViewOfFile(mem);
+}
+
+#else
+
+void* shared_mem_open(const std::string&, size_t&, bool& created, int& lock) {
+
+  created = false;
+  lock = -1;
+  return nullptr;
+}
+
+void shared_mem_close(const std::string&, void*, size_t, int) {}
+
+#endif
+
+
 namespace WinProcGroup {
 
 #ifndef _WIN32
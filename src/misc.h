@@ -42,6 +42,8 @@ void prefetch(void* addr);
 void start_logger(const std::string& fname);
 void* aligned_ttmem_alloc(size_t size, void*& mem);
 void aligned_ttmem_free(void* mem); // nop if mem == nullptr
+void* shared_mem_open(const std::string& name, size_t& size, bool& created, int& lock);
+void shared_mem_close(const std::string& name, void* mem, size_t size, int lock); // nop if mem == nullptr
 
 void dbg_hit_on(bool b);
 void dbg_hit_on(bool c, bool b);
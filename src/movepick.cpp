@@ -264,3 +264,27 @@ top:
   assert(false);
   return MOVE_NONE; // Silence warning
 }
+
+
+/// MovePicker::peek() guesses the move that next_move() returns next, without
+/// moving on, so that the search can prefetch what that move will need. The
+/// guess is not filtered. It is only made in the stages that return the moves
+/// in list order, the others would have to scan the list for the best one, and
+/// MOVE_NONE is returned there.
+
+Move MovePicker::peek() const {
+
+  if (cur >= endMoves)
+      return MOVE_NONE;
+
+  switch (stage) {
+
+  case QUIET:
+  case BAD_CAPTURE:
+  case QCHECK:
+      return *cur;
+
+  default:
+      return MOVE_NONE;
+  }
+}
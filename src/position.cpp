@@ -711,7 +711,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   assert(is_ok(m));
   assert(&newSt != st);
 
-  thisThread->nodes.fetch_add(1, std::memory_order_relaxed);
+  thisThread->counters.count(NODES);
   Key k = st->key ^ Zobrist::side;
 
   // Copy some fields of the old state to our new StateInfo object except the
@@ -920,6 +920,13 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       st->rule50 = 0;
   }
 
+#if defined(EVAL_NNUE) && !defined(NO_PREFETCH)
+  // dirtyPiece is complete here, so start loading the weight columns that the
+  // accumulator update will read long before evaluate() gets to them.
+  if (Eval::useNNUE)
+      Eval::prefetch_feature_weights(*this);
+#endif  // defined(EVAL_NNUE) && !defined(NO_PREFETCH)
+
   // Set capture piece
   st->capturedPiece = captured;
 
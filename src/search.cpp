@@ -25,7 +25,10 @@
 #include <iostream>
 #include <sstream>
 
+#include "analysis_store.h"
+#include "book.h"
 #include "evaluate.h"
+#include "mate_search.h"
 #include "misc.h"
 #include "movegen.h"
 #include "movepick.h"
@@ -87,9 +90,22 @@ namespace {
     return d > 15 ? 27 : 17 * d * d + 133 * d - 134;
   }
 
+  // Up to this depth the search of a move is short, so while it runs the memory
+  // needed by the next move is prefetched
+  constexpr Depth SpeculativePrefetchDepth = 2;
+
+  // Prefetch the TT entry of the position after the move and what its evaluation will read
+  void prefetch_after(const Position& pos, Move move) {
+    const Key key = pos.key_after(move);
+    prefetch(TT.first_entry(key));
+#if defined(EVAL_NNUE)
+    Eval::prefetch_move(pos, move, key);
+#endif
+  }
+
   // Add a small random component to draw evaluations to avoid 3fold-blindness
   Value value_draw(Thread* thisThread) {
-    return VALUE_DRAW + Value(2 * (thisThread->nodes & 1) - 1);
+    return VALUE_DRAW + Value(2 * (thisThread->counters[NODES] & 1) - 1);
   }
 
   // Skill structure is used to implement strength limit
@@ -186,6 +202,186 @@ namespace {
     return nodes;
   }
 
+  // use_book_move() plays a move from the opening book during the first
+  // BookMoves plies of a game, without searching. The book reply to it, if
+  // any, is sent as the ponder move. Analysis and fixed depth or nodes
+  // searches do not use the book.
+  bool use_book_move(MainThread* th) {
+
+    Position& pos = th->rootPos;
+
+    if (   Limits.infinite
+        || Limits.mate
+        || Limits.depth
+        || Limits.nodes
+        || !Limits.searchmoves.empty()
+        || Options["UCI_AnalyseMode"]
+        || pos.game_ply() >= int(Options["BookMoves"]))
+        return false;
+
+    static PRNG rng(now());
+    const bool pickBest = Options["BestBookMove"];
+
+    Move m = Book::probe(pos, rng.rand<uint64_t>(), pickBest);
+    auto rm = std::find(th->rootMoves.begin(), th->rootMoves.end(), m);
+
+    if (m == MOVE_NONE || rm == th->rootMoves.end())
+        return false;
+
+    std::rotate(th->rootMoves.begin(), rm, rm + 1);
+
+    RootMove& best = th->rootMoves[0];
+    best.score = VALUE_INFINITE; // Unknown, as after 'ucinewgame'
+    best.pv.resize(1);
+
+    StateInfo st;
+    pos.do_move(m, st);
+    Move reply = Book::probe(pos, rng.rand<uint64_t>(), pickBest);
+    pos.undo_move(m);
+
+    if (reply != MOVE_NONE)
+        best.pv.push_back(reply);
+
+    sync_cout << "info string Book move " << UCI::move(m, pos.is_chess960()) << sync_endl;
+    return true;
+  }
+
+  // use_stored_analysis() looks up the root position in the analysis store. If
+  // the stored result is deep enough for a 'go depth' request it becomes the
+  // result of the search and true is returned. Otherwise the stored best move
+  // is searched first and the stored PV is inserted into the TT.
+  bool use_stored_analysis(MainThread* th) {
+
+    Position& pos = th->rootPos;
+    AnalysisStore::Entry e;
+
+    if (   !Limits.searchmoves.empty()
+        || TB::RootInTB
+        || !AnalysisStore::probe(pos, e))
+        return false;
+
+    auto rm = std::find(th->rootMoves.begin(), th->rootMoves.end(), e.pv[0]);
+    if (rm == th->rootMoves.end())
+        return false;
+
+    std::rotate(th->rootMoves.begin(), rm, rm + 1);
+    th->counters.set(NODES, 0); // Checking the PV is not part of the search
+
+    if (   Limits.depth
+        && e.depth >= Limits.depth
+        && e.bound == BOUND_EXACT
+        && !Limits.infinite
+        && !Limits.mate
+        && !th->ponder
+        && int(Options["MultiPV"]) == 1
+        && !(Skill(Options["Skill Level"]).enabled() || int(Options["UCI_LimitStrength"])))
+    {
+        RootMove& best = th->rootMoves[0];
+        best.score = e.score;
+        best.selDepth = e.depth;
+        best.pv = e.pv;
+        th->completedDepth = e.depth;
+
+        sync_cout << UCI::pv(pos, e.depth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
+        return true;
+    }
+
+    // Let the stored PV guide the search, like a PV found by a previous search
+    std::vector<StateInfo, AlignedAllocator<StateInfo>> states(e.pv.size());
+
+    for (size_t i = 0; i < e.pv.size(); ++i)
+    {
+        bool ttHit;
+        TTEntry* tte = TT.probe(pos.key(), ttHit);
+
+        if (!ttHit || tte->move() != e.pv[i])
+            tte->save(pos.key(), VALUE_NONE, ttHit && tte->is_pv(), BOUND_NONE, DEPTH_NONE, e.pv[i], VALUE_NONE);
+
+        pos.do_move(e.pv[i], states[i]);
+    }
+
+    for (auto it = e.pv.rbegin(); it != e.pv.rend(); ++it)
+        pos.undo_move(*it);
+
+    th->counters.set(NODES, 0);
+    return false;
+  }
+
+  // split_root_moves() moves to the front the root moves that the given group
+  // of threads searches at the given depth, that is every pvGroups-th move of
+  // the order of that depth, and returns their number. The order is fixed by
+  // the first thread to start the depth, so that all the groups split the
+  // moves alike even if the main thread merges new lines meanwhile.
+  size_t split_root_moves(RootMoves& rootMoves, size_t group, Depth depth) {
+
+    std::vector<Move> order;
+    {
+        std::lock_guard<std::mutex> lk(Threads.pvMutex);
+        if (Threads.splitOrder[depth].empty())
+            Threads.splitOrder[depth] = Threads.pvOrder;
+        order = Threads.splitOrder[depth];
+    }
+
+    auto in_group = [&](const RootMove& rm) {
+        size_t rank = std::find(order.begin(), order.end(), rm.pv[0]) - order.begin();
+        return rank % Threads.pvGroups == group;
+    };
+
+    return std::stable_partition(rootMoves.begin(), rootMoves.end(), in_group) - rootMoves.begin();
+  }
+
+  // publish_lines() shares the first lines of a completed iteration of a group
+  // of threads, unless another thread of the group has completed it first.
+  void publish_lines(const Thread* th, size_t group, size_t lines) {
+
+    std::lock_guard<std::mutex> lk(Threads.pvMutex);
+
+    RootMoves& published = Threads.groupLines[group][th->rootDepth];
+
+    if (published.empty())
+        published.assign(th->rootMoves.begin(), th->rootMoves.begin() + lines);
+
+    Threads.groupDepth[group] = std::max(Threads.groupDepth[group], th->rootDepth);
+  }
+
+  // merge_lines() collects the lines of all the groups at the deepest depth
+  // that every group has completed into the root moves of the main thread,
+  // sorted by score and followed by the other moves, and publishes the
+  // resulting order. The groups split the moves alike at a given depth, so
+  // the lines are distinct. Returns the depth, 0 if a group has none yet.
+  Depth merge_lines(MainThread* th) {
+
+    std::lock_guard<std::mutex> lk(Threads.pvMutex);
+
+    const Depth depth = *std::min_element(Threads.groupDepth.begin(), Threads.groupDepth.end());
+
+    if (!depth)
+        return 0;
+
+    RootMoves merged;
+
+    for (size_t g = 0; g < Threads.pvGroups; ++g)
+        merged.insert(merged.end(), Threads.groupLines[g][depth].begin(),
+                                    Threads.groupLines[g][depth].end());
+
+    std::stable_sort(merged.begin(), merged.end());
+
+    for (const RootMove& rm : th->rootMoves)
+        if (std::find(merged.begin(), merged.end(), rm.pv[0]) == merged.end())
+        {
+            merged.push_back(rm);
+            merged.back().score = -VALUE_INFINITE;
+        }
+
+    th->rootMoves = merged;
+
+    Threads.pvOrder.clear();
+    for (const RootMove& rm : th->rootMoves)
+        Threads.pvOrder.push_back(rm.pv[0]);
+
+    return depth;
+  }
+
 } // namespace
 
 
@@ -205,7 +401,8 @@ void Search::clear() {
   Threads.main()->wait_for_search_finished();
 
   Time.availableNodes = 0;
-  TT.clear();
+  TT.new_game();
+  MateSearch::clear();
   Threads.clear();
   Tablebases::init(Options["SyzygyPath"]); // Free mapped files
 }
@@ -218,8 +415,8 @@ void MainThread::search() {
 
   if (Limits.perft)
   {
-      nodes = perft<true>(rootPos, Limits.perft);
-      sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
+      counters.set(NODES, perft<true>(rootPos, Limits.perft));
+      sync_cout << "\nNodes searched: " << counters[NODES] << "\n" << sync_endl;
       return;
   }
 
@@ -234,8 +431,29 @@ void MainThread::search() {
                 << UCI::value(rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW)
                 << sync_endl;
   }
-  else
+  else if (   !(Limits.mate && Options["MateSolver"] && MateSearch::search(this))
+           && !use_book_move(this)
+           && !use_stored_analysis(this))
   {
+      // With SplitMultiPV, the lines are shared among groups of threads
+      size_t multiPV = std::min(size_t(Options["MultiPV"]), rootMoves.size());
+
+      if (   Options["SplitMultiPV"]
+          && multiPV > 1
+          && Threads.size() > 1
+          && !TB::RootInTB
+          && !(Skill(Options["Skill Level"]).enabled() || int(Options["UCI_LimitStrength"])))
+      {
+          Threads.pvGroups = std::min(Threads.size(), multiPV);
+          Threads.pvOrder.clear();
+          for (const RootMove& rm : rootMoves)
+              Threads.pvOrder.push_back(rm.pv[0]);
+          Threads.splitOrder.assign(MAX_PLY + 1, std::vector<Move>());
+          Threads.groupLines.assign(Threads.pvGroups, std::vector<RootMoves>(MAX_PLY + 1));
+          Threads.groupDepth.assign(Threads.pvGroups, 0);
+          reportedDepth = 0;
+      }
+
       Threads.start_searching(); // start non-main threads
       Thread::search();          // main thread start searching
   }
@@ -250,12 +468,22 @@ void MainThread::search() {
   {} // Busy wait for a stop or a ponder reset
 
   // Stop the threads if not already stopped (also raise the stop if
-  // "ponderhit" just reset Threads.ponder).
-  Threads.stop = true;
+  // "ponderhit" just reset Threads.ponder). With split MultiPV and a depth
+  // limit, every group stops by itself once it has completed that depth.
+  if (!(Threads.pvGroups && Limits.depth))
+      Threads.stop = true;
 
   // Wait until all threads have finished
   Threads.wait_for_search_finished();
 
+  // Collect the last lines completed by all the groups
+  if (Threads.pvGroups)
+  {
+      if (Depth d = merge_lines(this))
+          sync_cout << UCI::pv(rootPos, d, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
+      Threads.pvGroups = 0;
+  }
+
   // When playing in 'nodes as time' mode, subtract the searched nodes from
   // the available ones before exiting.
   if (Limits.npmsec)
@@ -270,6 +498,7 @@ void MainThread::search() {
       bestThread = Threads.get_best_thread();
 
   bestPreviousScore = bestThread->rootMoves[0].score;
+  bestMove = bestThread->rootMoves[0].pv[0];
 
   // Send again PV info if we have a new best thread
   if (bestThread != this)
@@ -299,6 +528,7 @@ void Thread::search() {
   Value bestValue, alpha, beta, delta;
   Move  lastBestMove = MOVE_NONE;
   Depth lastBestMoveDepth = 0;
+  AnalysisStore::Entry completed { 0, VALUE_NONE, BOUND_EXACT, {} };
   MainThread* mainThread = (this == Threads.main() ? Threads.main() : nullptr);
   double timeReduction = 1, totBestMoveChanges = 0;
   Color us = rootPos.side_to_move();
@@ -347,6 +577,13 @@ void Thread::search() {
       multiPV = std::max(multiPV, (size_t)4);
 
   multiPV = std::min(multiPV, rootMoves.size());
+
+  // With split MultiPV, the group of the thread searches its share of the lines
+  // among its share of the root moves, which changes at every iteration.
+  size_t rootEnd = rootMoves.size();
+  const size_t group = Threads.pvGroups ? idx % Threads.pvGroups : 0;
+  const size_t groupPV = Threads.pvGroups ? (multiPV + Threads.pvGroups - 1) / Threads.pvGroups : multiPV;
+
   ttHitAverage = TtHitAverageWindow * TtHitAverageResolution / 2;
 
   int ct = int(Options["Contempt"]) * PawnValueEg / 100; // From centipawns
@@ -368,7 +605,7 @@ void Thread::search() {
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   ++rootDepth < MAX_PLY
          && !Threads.stop
-         && !(Limits.depth && mainThread && rootDepth > Limits.depth))
+         && !(Limits.depth && (mainThread || Threads.pvGroups) && rootDepth > Limits.depth))
   {
       // Age out PV variability metric
       if (mainThread)
@@ -379,6 +616,12 @@ void Thread::search() {
       for (RootMove& rm : rootMoves)
           rm.previousScore = rm.score;
 
+      if (Threads.pvGroups)
+      {
+          rootEnd = split_root_moves(rootMoves, group, rootDepth);
+          multiPV = std::min(groupPV, rootEnd);
+      }
+
       size_t pvFirst = 0;
       pvLast = 0;
 
@@ -391,7 +634,7 @@ void Thread::search() {
           if (pvIdx == pvLast)
           {
               pvFirst = pvLast;
-              for (pvLast++; pvLast < rootMoves.size(); pvLast++)
+              for (pvLast++; pvLast < rootEnd; pvLast++)
                   if (rootMoves[pvLast].tbRank != rootMoves[pvFirst].tbRank)
                       break;
           }
@@ -441,6 +684,7 @@ void Thread::search() {
               // the UI) before a re-search.
               if (   mainThread
                   && multiPV == 1
+                  && !Threads.pvGroups
                   && (bestValue <= alpha || bestValue >= beta)
                   && Time.elapsed() > 3000)
                   sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
@@ -476,13 +720,35 @@ void Thread::search() {
           std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
 
           if (    mainThread
+              && !Threads.pvGroups
               && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
               sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
       }
 
+      // Share the lines of the group, the main thread also merges all of them
+      if (Threads.pvGroups && !Threads.stop)
+      {
+          publish_lines(this, group, multiPV);
+
+          // Report a depth once all the groups have completed it
+          if (mainThread)
+          {
+              Depth d = merge_lines(mainThread);
+              if (d > mainThread->reportedDepth)
+              {
+                  mainThread->reportedDepth = d;
+                  sync_cout << UCI::pv(rootPos, d, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
+              }
+          }
+      }
+
       if (!Threads.stop)
           completedDepth = rootDepth;
 
+      // Remember the last completed iteration for the analysis store
+      if (mainThread && !Threads.stop)
+          completed = { rootDepth, rootMoves[0].score, BOUND_EXACT, rootMoves[0].pv };
+
       if (rootMoves[0].pv[0] != lastBestMove) {
          lastBestMove = rootMoves[0].pv[0];
          lastBestMoveDepth = rootDepth;
@@ -552,6 +818,9 @@ void Thread::search() {
 
   mainThread->previousTimeReduction = timeReduction;
 
+  if (!skill.enabled() && Limits.searchmoves.empty() && !TB::RootInTB)
+      AnalysisStore::save(rootPos, completed);
+
   // If skill level is enabled, swap best PV line with the sub-optimal one
   if (skill.enabled())
       std::swap(rootMoves[0], *std::find(rootMoves.begin(), rootMoves.end(),
@@ -733,7 +1002,7 @@ namespace {
 
             if (err != TB::ProbeState::FAIL)
             {
-                thisThread->tbHits.fetch_add(1, std::memory_order_relaxed);
+                thisThread->counters.count(TB_HITS);
 
                 int drawScore = TB::UseRule50 ? 1 : 0;
 
@@ -1140,6 +1409,10 @@ moves_loop: // When in check, search starts from here
       // Speculative prefetch as early as possible
       prefetch(TT.first_entry(pos.key_after(move)));
 
+      if (depth <= SpeculativePrefetchDepth)
+          if (Move next = mp.peek())
+              prefetch_after(pos, next);
+
       // Check for legality just before making the move
       if (!rootNode && !pos.legal(move))
       {
@@ -1386,7 +1659,7 @@ moves_loop: // When in check, search starts from here
     if (PvNode)
         bestValue = std::min(bestValue, maxValue);
 
-    if (!excludedMove && !(rootNode && thisThread->pvIdx))
+    if (!excludedMove && !(rootNode && (thisThread->pvIdx || Threads.pvGroups)))
         tte->save(posKey, value_to_tt(bestValue, ss->ply), ttPv,
                   bestValue >= beta ? BOUND_LOWER :
                   PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
@@ -1552,6 +1825,9 @@ moves_loop: // When in check, search starts from here
       // Speculative prefetch as early as possible
       prefetch(TT.first_entry(pos.key_after(move)));
 
+      if (Move next = mp.peek())
+          prefetch_after(pos, next);
+
       // Check for legality just before making the move
       if (
 #if defined(EVAL_LEARN)
@@ -1842,7 +2118,7 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
   {
       bool updated = rootMoves[i].score != -VALUE_INFINITE;
 
-      if (depth == 1 && !updated)
+      if ((depth == 1 || Threads.pvGroups) && !updated)
           continue;
 
       Depth d = updated ? depth : depth - 1;
@@ -2023,7 +2299,7 @@ namespace Learner
       th->rootDepth = 0;
 
 	  // Zero initialization of the number of search nodes
-      th->nodes = 0;
+      th->counters.set(NODES, 0);
 
       // Clear all history types. This initialization takes a little time, and the accuracy of the search is rather low, so the good and bad are not well understood.
       // th->clear();
@@ -2173,7 +2449,7 @@ namespace Learner
     while ((rootDepth += 1) <= depth
 	  // exit this loop even if the node limit is exceeded
       // The number of search nodes is passed in the argument of this function.
-      && !(nodesLimit /* limited nodes */ && th->nodes.load(std::memory_order_relaxed) >= nodesLimit)
+      && !(nodesLimit /* limited nodes */ && th->counters[NODES] >= nodesLimit)
       )
     {
       for (RootMove& rm : rootMoves)
@@ -2241,7 +2517,7 @@ namespace Learner
           assert(-VALUE_INFINITE <= alpha && beta <= VALUE_INFINITE);
 
           // runaway check
-          //assert(th->nodes.load(std::memory_order_relaxed) <= 1000000 );
+          //assert(th->counters[NODES] <= 1000000 );
         }
 
         stable_sort(rootMoves.begin(), rootMoves.begin() + pvIdx + 1);
@@ -28,6 +28,7 @@
 #include <sstream>
 #include <type_traits>
 #include <mutex>
+#include <vector>
 
 #include "../bitboard.h"
 #include "../movegen.h"
@@ -201,7 +202,7 @@ public:
 
     // Memory map the file and check it. File should be already open and will be
     // closed after mapping.
-    uint8_t* map(void** baseAddress, uint64_t* mapping, TBType type) {
+    uint8_t* map(void** baseAddress, uint64_t* mapping, uint64_t* size, TBType type) {
 
         assert(is_open());
 
@@ -222,7 +223,7 @@ public:
             exit(EXIT_FAILURE);
         }
 
-        *mapping = statbuf.st_size;
+        *mapping = *size = statbuf.st_size;
         *baseAddress = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
         madvise(*baseAddress, statbuf.st_size, MADV_RANDOM);
         ::close(fd);
@@ -259,6 +260,7 @@ public:
         }
 
         *mapping = (uint64_t)mmap;
+        *size = uint64_t(size_high) << 32 | size_low;
         *baseAddress = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
 
         if (!*baseAddress)
@@ -321,20 +323,165 @@ struct PairsData {
     uint16_t map_idx[4];           // WDLWin, WDLLoss, WDLCursedWin, WDLBlessedLoss (used in DTZ)
 };
 
+// struct TBMapping holds the memory mapping of a TB file, shared by both types
+// of TBTable so that MappedTables can unmap any of them. A probe pins the table
+// while it reads the mapped data, a table is only unmapped when it is not pinned.
+struct TBMapping {
+    std::atomic_bool ready;          // Mapped, or known to be missing, and set
+    void* baseAddress;
+    uint64_t mapping;
+    uint64_t mapSize;                // Size of the mapped file in bytes
+    std::mutex mutex;                // Held while the file is mapped or unmapped
+    std::atomic<uint32_t> pins;      // Number of probes reading the mapped data
+    std::atomic<uint64_t> lastUse;   // MappedTables clock at the latest probe
+
+    TBMapping() : ready(false), baseAddress(nullptr), mapSize(0), pins(0), lastUse(0) {}
+
+    ~TBMapping() {
+        if (baseAddress)
+            TBFile::unmap(baseAddress, mapping);
+    }
+};
+
+// class MappedTables keeps track of the mapped TB files. When a mapping budget
+// is set with the SyzygyMapCount and SyzygyMapSize UCI options, mapping a new
+// file unmaps the least recently probed tables until the budget is met again.
+// The clock advances at every new mapping, so that the probes between two
+// mappings share a time stamp and the fast path of a probe writes lastUse at
+// most once per table in that span.
+class MappedTables {
+
+    std::mutex mutex;
+    std::vector<TBMapping*> tables;
+    uint64_t bytes = 0;
+    size_t maxCount = 0;   // 0 is unlimited
+    uint64_t maxBytes = 0; // 0 is unlimited
+
+    bool over_budget() const {
+        return   (maxCount && tables.size() > maxCount)
+              || (maxBytes && bytes > maxBytes);
+    }
+
+    bool unmap(TBMapping* e);
+    void trim(const TBMapping* keep);
+
+public:
+    std::atomic<uint64_t> clock{1}, maps{0}, unmaps{0}, stalls{0};
+    std::atomic_bool limited{false}; // A budget is set, tables may be unmapped
+
+    void add(TBMapping* e);
+    void set_budget(size_t count, uint64_t size);
+    void clear();
+    std::string stats();
+};
+
+MappedTables MappedTables;
+
+// Try to unmap a table. Gives up if another thread holds the table's lock or
+// a probe has pinned it. Called with the MappedTables lock held.
+bool MappedTables::unmap(TBMapping* e) {
+
+    std::unique_lock<std::mutex> lk(e->mutex, std::try_to_lock);
+
+    if (!lk.owns_lock())
+        return false;
+
+    // Clearing 'ready' before reading 'pins', while a probe increments 'pins'
+    // before reading 'ready', ensures either the probe sees the table as not
+    // ready and waits for the lock, or we see it pinned and keep the mapping.
+    e->ready.store(false);
+
+    if (e->pins.load())
+    {
+        e->ready.store(true);
+        return false;
+    }
+
+    TBFile::unmap(e->baseAddress, e->mapping);
+    e->baseAddress = nullptr;
+
+    bytes -= e->mapSize;
+    tables.erase(std::find(tables.begin(), tables.end(), e));
+    unmaps.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// Unmap the least recently probed tables, except 'keep', until the budget is met
+void MappedTables::trim(const TBMapping* keep) {
+
+    if (!over_budget())
+        return;
+
+    std::vector<TBMapping*> victims;
+
+    for (TBMapping* e : tables)
+        if (e != keep)
+            victims.push_back(e);
+
+    std::sort(victims.begin(), victims.end(), [](const TBMapping* a, const TBMapping* b) {
+        return a->lastUse.load(std::memory_order_relaxed) < b->lastUse.load(std::memory_order_relaxed);
+    });
+
+    for (TBMapping* e : victims)
+        if (!over_budget() || (unmap(e) && !over_budget()))
+            break;
+}
+
+// Register a just mapped table, the caller holds the table's lock
+void MappedTables::add(TBMapping* e) {
+
+    std::unique_lock<std::mutex> lk(mutex);
+
+    tables.push_back(e);
+    bytes += e->mapSize;
+    maps.fetch_add(1, std::memory_order_relaxed);
+    e->lastUse.store(clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    trim(e);
+}
+
+void MappedTables::set_budget(size_t count, uint64_t size) {
+
+    std::unique_lock<std::mutex> lk(mutex);
+
+    maxCount = count;
+    maxBytes = size;
+    limited = count || size;
+    trim(nullptr);
+}
+
+// Forget the tables, called before TBTables frees them and their mappings
+void MappedTables::clear() {
+
+    std::unique_lock<std::mutex> lk(mutex);
+
+    tables.clear();
+    bytes = 0;
+}
+
+std::string MappedTables::stats() {
+
+    std::unique_lock<std::mutex> lk(mutex);
+    std::stringstream ss;
+
+    ss << "info string Syzygy mapped files " << tables.size()
+       << " size " << (bytes >> 20) << " MB"
+       << " maps " << maps << " unmaps " << unmaps << " stalls " << stalls;
+
+    return ss.str();
+}
+
 // struct TBTable contains indexing information to access the corresponding TBFile.
 // There are 2 types of TBTable, corresponding to a WDL or a DTZ file. TBTable
 // is populated at init time but the nested PairsData records are populated at
-// first access, when the corresponding file is memory mapped.
+// first access, when the corresponding file is memory mapped, and again after
+// MappedTables has unmapped it.
 template<TBType Type>
-struct TBTable {
+struct TBTable : public TBMapping {
     typedef typename std::conditional<Type == WDL, WDLScore, int>::type Ret;
 
     static constexpr int Sides = Type == WDL ? 2 : 1;
 
-    std::atomic_bool ready;
-    void* baseAddress;
     uint8_t* map;
-    uint64_t mapping;
     Key key;
     Key key2;
     int pieceCount;
@@ -347,14 +494,9 @@ struct TBTable {
         return &items[stm % Sides][hasPawns ? f : 0];
     }
 
-    TBTable() : ready(false), baseAddress(nullptr) {}
+    TBTable() = default;
     explicit TBTable(const std::string& code);
     explicit TBTable(const TBTable<WDL>& wdl);
-
-    ~TBTable() {
-        if (baseAddress)
-            TBFile::unmap(baseAddress, mapping);
-    }
 };
 
 template<>
@@ -1128,19 +1270,35 @@ void set(T& e, uint8_t* data) {
 
 // If the TB file corresponding to the given position is already memory mapped
 // then return its base address, otherwise try to memory map and init it. Called
-// at every probe, memory map and init only at first access. Function is thread
-// safe and can be called concurrently.
+// at every probe with the table pinned, memory map and init only at first access
+// and after MappedTables has unmapped the file. Function is thread safe and can
+// be called concurrently, each table has its own lock so that mapping a file
+// does not hold up the probes of the other tables.
 template<TBType Type>
 void* mapped(TBTable<Type>& e, const Position& pos) {
 
-    static std::mutex mutex;
+    // The load pairs with the store in MappedTables::unmap(), see there. It also
+    // keeps a thread from reading 'ready' == true while another is still working.
+    if (e.ready.load())
+    {
+        if (MappedTables.limited.load(std::memory_order_relaxed))
+        {
+            const uint64_t now = MappedTables.clock.load(std::memory_order_relaxed);
+
+            if (e.lastUse.load(std::memory_order_relaxed) != now)
+                e.lastUse.store(now, std::memory_order_relaxed);
+        }
 
-    // Use 'acquire' to avoid a thread reading 'ready' == true while
-    // another is still working. (compiler reordering may cause this).
-    if (e.ready.load(std::memory_order_acquire))
         return e.baseAddress; // Could be nullptr if file does not exist
+    }
 
-    std::unique_lock<std::mutex> lk(mutex);
+    std::unique_lock<std::mutex> lk(e.mutex, std::try_to_lock);
+
+    if (!lk.owns_lock())
+    {
+        MappedTables.stalls.fetch_add(1, std::memory_order_relaxed);
+        lk.lock();
+    }
 
     if (e.ready.load(std::memory_order_relaxed)) // Recheck under lock
         return e.baseAddress;
@@ -1155,10 +1313,13 @@ void* mapped(TBTable<Type>& e, const Position& pos) {
     fname =  (e.key == pos.material_key() ? w + 'v' + b : b + 'v' + w)
            + (Type == WDL ? ".rtbw" : ".rtbz");
 
-    uint8_t* data = TBFile(fname).map(&e.baseAddress, &e.mapping, Type);
+    uint8_t* data = TBFile(fname).map(&e.baseAddress, &e.mapping, &e.mapSize, Type);
 
     if (data)
+    {
         set(e, data);
+        MappedTables.add(&e);
+    }
 
     e.ready.store(true, std::memory_order_release);
     return e.baseAddress;
@@ -1172,10 +1333,24 @@ Ret probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw)
 
     TBTable<Type>* entry = TBTables.get<Type>(pos.material_key());
 
-    if (!entry || !mapped(*entry, pos))
+    if (!entry)
         return *result = FAIL, Ret();
 
-    return do_probe_table(pos, entry, wdl, result);
+    // Pin the table so that it is not unmapped while we read it. Without a
+    // budget no table is ever unmapped, and the budget only changes while no
+    // search is running, so the pin is skipped.
+    const bool pin = MappedTables.limited.load(std::memory_order_relaxed);
+
+    if (pin)
+        entry->pins.fetch_add(1);
+
+    Ret ret = mapped(*entry, pos) ? do_probe_table(pos, entry, wdl, result)
+                                  : (*result = FAIL, Ret());
+
+    if (pin)
+        entry->pins.fetch_sub(1, std::memory_order_release);
+
+    return ret;
 }
 
 // For a position where the side to move has a winning capture it is not necessary
@@ -1261,6 +1436,7 @@ WDLScore search(Position& pos, ProbeState* result) {
 /// safe, nor it needs to be.
 void Tablebases::init(const std::string& paths) {
 
+    MappedTables.clear();
     TBTables.clear();
     MaxCardinality = 0;
     TBFile::Paths = paths;
@@ -1403,6 +1579,21 @@ void Tablebases::init(const std::string& paths) {
     sync_cout << "info string Found " << TBTables.size() << " tablebases" << sync_endl;
 }
 
+/// Tablebases::set_mapping_budget() limits the number of mapped TB files and
+/// their total size in MB, 0 is unlimited. Tables over the budget are unmapped
+/// at once, least recently probed first.
+void Tablebases::set_mapping_budget(size_t count, size_t mbSize) {
+
+    MappedTables.set_budget(count, uint64_t(mbSize) << 20);
+}
+
+/// Tablebases::mapping_stats() reports the mapped files and the number of
+/// mappings, unmappings and probes that waited for a table being mapped.
+std::string Tablebases::mapping_stats() {
+
+    return MappedTables.stats();
+}
+
 // Probe the WDL table for a particular position.
 // If *result != FAIL, the probe was successful.
 // The return value is from the point of view of the side to move:
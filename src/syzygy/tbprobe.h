@@ -47,6 +47,8 @@ enum ProbeState {
 extern int MaxCardinality;
 
 void init(const std::string& paths);
+void set_mapping_budget(size_t count, size_t mbSize);
+std::string mapping_stats();
 WDLScore probe_wdl(Position& pos, ProbeState* result);
 int probe_dtz(Position& pos, ProbeState* result);
 bool root_probe(Position& pos, Search::RootMoves& rootMoves);
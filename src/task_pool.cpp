@@ -0,0 +1,243 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2020 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cassert>
+
+#include "misc.h"
+#include "task_pool.h"
+
+TaskPool Tasks; // Global object
+
+namespace {
+
+  // Index of the pool worker running on the current thread
+  thread_local size_t WorkerIdx = TaskPool::NoWorker;
+
+} // namespace
+
+
+/// Worker constructor launches the thread, which blocks on the pool mutex
+/// until TaskPool::set() has created all the workers.
+
+TaskPool::Worker::Worker(TaskPool* p, size_t i, bool bind)
+  : pool(p), idx(i), bindThread(bind), nativeThread(&Worker::idle_loop, this) {}
+
+
+/// TaskPool::Worker::idle_loop() is where the worker sleeps until some task
+/// is queued for it or can be stolen from another worker.
+
+void TaskPool::Worker::idle_loop() {
+
+  WorkerIdx = idx;
+
+  // Same policy as the search threads: binding only pays off with many threads
+  if (bindThread)
+      WinProcGroup::bindThisThread(idx);
+
+  while (true)
+  {
+      {
+          std::unique_lock<std::mutex> lk(pool->mutex);
+          pool->cv.wait(lk, [&]{ return exit || pool->has_work(*this); });
+
+          if (exit && !pool->has_work(*this))
+              return;
+      }
+
+      while (pool->run_one(idx)) {}
+  }
+}
+
+
+/// TaskPool::set() creates/destroys workers to match the requested number.
+/// Queued tasks are run before the workers exit.
+
+void TaskPool::set(size_t requested) {
+
+  if (size() > 0) // destroy any existing worker(s)
+  {
+      {
+          std::lock_guard<std::mutex> lk(mutex);
+          for (Worker* w : workers)
+              w->exit = true;
+      }
+      cv.notify_all();
+
+      for (Worker* w : workers)
+          w->nativeThread.join();
+
+      while (size() > 0)
+          delete workers.back(), workers.pop_back();
+  }
+
+  if (requested > 0) // create new worker(s)
+  {
+      std::lock_guard<std::mutex> lk(mutex);
+
+      while (size() < requested)
+          workers.push_back(new Worker(this, size(), requested > 8));
+  }
+}
+
+
+/// TaskPool::worker_index() returns the index of the pool worker calling it,
+/// or NoWorker when called from any other thread.
+
+size_t TaskPool::worker_index() {
+  return WorkerIdx;
+}
+
+
+/// TaskPool::submit() queues a task that any worker may execute. From inside
+/// the pool the task goes to the caller's own deque, otherwise the workers
+/// are filled in turn.
+
+void TaskPool::submit(Group& group, Task task) {
+
+  assert(size() > 0);
+
+  size_t idx = worker_index();
+  if (idx == NoWorker)
+      idx = nextWorker++ % size();
+
+  push(idx, group, std::move(task), false);
+}
+
+
+/// TaskPool::submit_to() queues a task that only worker idx will execute, for
+/// long running jobs that are tied to a search thread of the same index.
+
+void TaskPool::submit_to(size_t idx, Group& group, Task task) {
+
+  assert(idx < size());
+
+  push(idx, group, std::move(task), true);
+}
+
+
+/// TaskPool::wait() returns when all the tasks of the group have been executed.
+/// A worker keeps executing queued tasks meanwhile, so nested parallel loops
+/// cannot deadlock the pool.
+
+void TaskPool::wait(Group& group) {
+
+  const size_t idx = worker_index();
+
+  while (!group.done())
+  {
+      if (idx != NoWorker && run_one(idx))
+          continue;
+
+      std::unique_lock<std::mutex> lk(mutex);
+      cv.wait(lk, [&]{ return group.done() || (idx != NoWorker && has_work(*workers[idx])); });
+  }
+}
+
+
+/// TaskPool::idle() lets worker idx execute the queued tasks, then waits at
+/// most ms milliseconds for new ones. It is meant for workers that spend a
+/// long time in a task of their own and poll some other condition.
+
+void TaskPool::idle(size_t idx, int ms) {
+
+  assert(idx == worker_index());
+
+  while (run_one(idx)) {}
+
+  std::unique_lock<std::mutex> lk(mutex);
+  cv.wait_for(lk, std::chrono::milliseconds(ms), [&]{ return has_work(*workers[idx]); });
+}
+
+
+void TaskPool::push(size_t idx, Group& group, Task task, bool pinned) {
+
+  Worker* w = workers[idx];
+
+  ++group.pending;
+
+  // Count the task under the pool mutex, so that no sleeping worker misses it
+  {
+      std::lock_guard<std::mutex> lk(mutex);
+      ++(pinned ? w->pinned : stealable);
+  }
+  {
+      std::lock_guard<std::mutex> lk(w->mutex);
+      w->queue.push_back(Entry{ std::move(task), &group, pinned });
+  }
+  cv.notify_all();
+}
+
+
+/// TaskPool::run_one() executes the most recent task of worker idx, or steals
+/// the oldest stealable one from another worker. Returns false if there was
+/// nothing to do.
+
+bool TaskPool::run_one(size_t idx) {
+
+  Worker* self = workers[idx];
+  Entry e;
+  bool found = false;
+
+  {
+      std::lock_guard<std::mutex> lk(self->mutex);
+      if (!self->queue.empty())
+      {
+          e = std::move(self->queue.back());
+          self->queue.pop_back();
+          found = true;
+      }
+  }
+
+  for (size_t k = 1; !found && k < size(); ++k)
+  {
+      Worker* victim = workers[(idx + k) % size()];
+      std::lock_guard<std::mutex> lk(victim->mutex);
+
+      auto it = std::find_if(victim->queue.begin(), victim->queue.end(),
+                             [](const Entry& x) { return !x.pinned; });
+      if (it != victim->queue.end())
+      {
+          e = std::move(*it);
+          victim->queue.erase(it);
+          found = true;
+      }
+  }
+
+  if (!found)
+      return false;
+
+  --(e.pinned ? self->pinned : stealable);
+
+  e.task(idx);
+
+  // The group may go out of scope as soon as it is done, do not touch it again
+  if (--e.group->pending == 0)
+  {
+      { std::lock_guard<std::mutex> lk(mutex); }
+      cv.notify_all();
+  }
+
+  return true;
+}
+
+
+bool TaskPool::has_work(const Worker& w) const {
+  return stealable > 0 || w.pinned > 0;
+}
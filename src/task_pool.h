@@ -0,0 +1,189 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2020 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TASK_POOL_H_INCLUDED
+#define TASK_POOL_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "thread_win32_osx.h"
+
+
+/// TaskPool is a persistent pool of worker threads used for everything that is
+/// not the search itself: clearing the hash, generating and learning from
+/// training data, and the various data tools. Every worker owns a deque of
+/// tasks; the owner pops from the back while idle workers steal from the front
+/// of the others, so that a batch submitted by one worker spreads over all of
+/// them. The pool is sized together with the search threads, so these jobs
+/// share the cores selected with the "Threads" option instead of spawning
+/// threads of their own.
+
+class TaskPool {
+
+public:
+  typedef std::function<void(size_t /* worker index */)> Task;
+
+  static constexpr size_t NoWorker = size_t(-1);
+
+  /// TaskPool::Group counts the tasks of one batch that are still pending, so
+  /// that the submitter can wait for exactly its own work.
+
+  class Group {
+    friend class TaskPool;
+    std::atomic<size_t> pending{0};
+  public:
+    bool done() const { return pending == 0; }
+  };
+
+  ~TaskPool() { set(0); }
+
+  void set(size_t requested);
+  size_t size() const { return workers.size(); }
+
+  void submit(Group& group, Task task);
+  void submit_to(size_t idx, Group& group, Task task);
+  void wait(Group& group);
+  void idle(size_t idx, int ms);
+
+  template<class Rep, class Period>
+  bool wait_for(Group& group, const std::chrono::duration<Rep, Period>& timeout);
+
+  template<typename F>
+  void parallel_for(size_t begin, size_t end, size_t grain, const F& f);
+
+  template<typename T, typename F, typename R>
+  T reduce(size_t begin, size_t end, size_t grain, T init, const F& map, const R& combine);
+
+  static size_t worker_index();
+
+private:
+  struct Entry {
+    Task task;
+    Group* group;
+    bool pinned;
+  };
+
+  struct Worker {
+    Worker(TaskPool* p, size_t i, bool bind);
+    void idle_loop();
+
+    TaskPool* pool;
+    size_t idx;
+    bool bindThread;
+    std::mutex mutex;
+    std::deque<Entry> queue;
+    std::atomic<size_t> pinned{0};
+    bool exit = false;
+    NativeThread nativeThread; // Last member, started once the others are set
+  };
+
+  void push(size_t idx, Group& group, Task task, bool pinned);
+  bool run_one(size_t idx);
+  bool has_work(const Worker& w) const;
+  size_t default_grain(size_t n) const {
+    const size_t w = std::max(size(), size_t(1));
+    return std::max(size_t(1), (n + w - 1) / w);
+  }
+
+  std::vector<Worker*> workers;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::atomic<size_t> stealable{0};
+  std::atomic<size_t> nextWorker{0};
+};
+
+extern TaskPool Tasks;
+
+
+/// TaskPool::wait_for() blocks a thread outside the pool until the group is
+/// done or the timeout expires. Returns true if the group is done.
+
+template<class Rep, class Period>
+bool TaskPool::wait_for(Group& group, const std::chrono::duration<Rep, Period>& timeout) {
+
+  std::unique_lock<std::mutex> lk(mutex);
+  return cv.wait_for(lk, timeout, [&]{ return group.done(); });
+}
+
+
+/// TaskPool::parallel_for() splits [begin, end) into chunks of at most grain
+/// indices and calls f(first, last) for each of them on the pool. Returns when
+/// all chunks have been processed. A grain of 0 gives one chunk per worker.
+
+template<typename F>
+void TaskPool::parallel_for(size_t begin, size_t end, size_t grain, const F& f) {
+
+  if (begin >= end)
+      return;
+
+  if (!grain)
+      grain = default_grain(end - begin);
+
+  if (!size() || end - begin <= grain)
+  {
+      f(begin, end);
+      return;
+  }
+
+  Group group;
+  for (size_t first = begin; first < end; )
+  {
+      const size_t last = std::min(end, first + grain);
+      submit(group, [&f, first, last](size_t) { f(first, last); });
+      first = last;
+  }
+  wait(group);
+}
+
+
+/// TaskPool::reduce() maps every chunk of [begin, end) to a value with
+/// map(first, last) and folds the results into init with combine(). Chunks are
+/// combined in index order, so the result does not depend on scheduling.
+
+template<typename T, typename F, typename R>
+T TaskPool::reduce(size_t begin, size_t end, size_t grain, T init, const F& map, const R& combine) {
+
+  if (begin >= end)
+      return init;
+
+  if (!grain)
+      grain = default_grain(end - begin);
+
+  std::vector<T> results((end - begin + grain - 1) / grain);
+
+  parallel_for(0, results.size(), 1, [&](size_t first, size_t last) {
+      for (size_t c = first; c < last; ++c)
+          results[c] = map(begin + c * grain, std::min(end, begin + (c + 1) * grain));
+  });
+
+  for (const T& r : results)
+      init = combine(init, r);
+
+  return init;
+}
+
+#endif // #ifndef TASK_POOL_H_INCLUDED
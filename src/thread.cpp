@@ -23,6 +23,7 @@
 #include <algorithm> // For std::count
 #include "movegen.h"
 #include "search.h"
+#include "task_pool.h"
 #include "thread.h"
 #include "uci.h"
 #include "syzygy/tbprobe.h"
@@ -146,6 +147,9 @@ void ThreadPool::set(size_t requested) {
           delete back(), pop_back();
   }
 
+  // The task pool shares the cores of the search threads
+  Tasks.set(requested);
+
   if (requested > 0) { // create new thread(s)
       push_back(new MainThread(0));
 
@@ -213,7 +217,8 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
 
   for (Thread* th : *this)
   {
-      th->nodes = th->tbHits = th->nmpMinPly = th->bestMoveChanges = 0;
+      th->counters.clear();
+      th->nmpMinPly = th->bestMoveChanges = 0;
       th->rootDepth = th->completedDepth = 0;
       th->rootMoves = rootMoves;
       th->rootPos.set(pos.fen(), pos.is_chess960(), &setupStates->back(), th);
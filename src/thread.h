@@ -35,6 +35,41 @@
 #include "thread_win32_osx.h"
 
 
+/// Counter lists the statistics counted by every thread
+
+enum Counter { NODES, TB_HITS, EVALS, NNUE_REFRESHES, COUNTER_NB };
+
+
+/// ThreadCounters holds the counters of a thread on cache lines of their own.
+/// count() is a relaxed load and store instead of the locked read-modify-write
+/// of fetch_add(), so each counter must have a single writer at a time: the
+/// search thread itself, or the task pool worker of the same index that works
+/// on its behalf while it idles (the mate solver). A Position must therefore
+/// never be shared by threads running concurrently, nor be set() with the
+/// Thread of another running thread. Other threads may read the counters at
+/// any time and see values a few increments old at most, they set them only
+/// while the thread is not searching.
+
+struct alignas(64) ThreadCounters {
+
+  void count(Counter c) {
+    values[c].store(values[c].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  uint64_t operator[](Counter c) const { return values[c].load(std::memory_order_relaxed); }
+
+  void clear() {
+    for (auto& v : values)
+        v.store(0, std::memory_order_relaxed);
+  }
+
+  void set(Counter c, uint64_t v) { values[c].store(v, std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> values[COUNTER_NB];
+};
+
+
 /// Thread class keeps together all the thread-related stuff. We use
 /// per-thread pawn and material hash tables so that once we get a
 /// pointer to an entry its life time is unlimited and we don't have
@@ -64,7 +99,8 @@ public:
   uint64_t ttHitAverage;
   int selDepth, nmpMinPly;
   Color nmpColor;
-  std::atomic<uint64_t> nodes, tbHits, bestMoveChanges;
+  std::atomic<uint64_t> bestMoveChanges;
+  ThreadCounters counters;
 
   Position rootPos;
   Search::RootMoves rootMoves;
@@ -89,7 +125,9 @@ struct MainThread : public Thread {
 
   double previousTimeReduction;
   Value bestPreviousScore;
+  Move bestMove;
   Value iterValue[4];
+  Depth reportedDepth; // Last depth of the split MultiPV lines sent to the GUI
   int callsCnt;
   bool stopOnPonderhit;
   std::atomic_bool ponder;
@@ -107,26 +145,42 @@ struct ThreadPool : public std::vector<Thread*> {
   void set(size_t);
 
   MainThread* main()        const { return static_cast<MainThread*>(front()); }
-  uint64_t nodes_searched() const { return accumulate(&Thread::nodes); }
-  uint64_t tb_hits()        const { return accumulate(&Thread::tbHits); }
+  uint64_t nodes_searched() const { return accumulate(NODES); }
+  uint64_t tb_hits()        const { return accumulate(TB_HITS); }
+  uint64_t accumulate(Counter c) const;
   Thread* get_best_thread() const;
   void start_searching();
   void wait_for_search_finished() const;
 
   std::atomic_bool stop, increaseDepth;
 
+  // When the MultiPV lines are split among pvGroups groups of threads, the
+  // root moves are dealt to the groups in the order fixed for each depth by
+  // the first thread to start it, taken from the order last published by the
+  // main thread. Each group publishes its lines of every completed depth, and
+  // the main thread merges those of the deepest depth all groups completed.
+  size_t pvGroups;
+  std::mutex pvMutex;
+  std::vector<Move> pvOrder;
+  std::vector<std::vector<Move>> splitOrder;         // [depth]
+  std::vector<std::vector<Search::RootMoves>> groupLines; // [group][depth]
+  std::vector<Depth> groupDepth;
+
 private:
   StateListPtr setupStates;
-
-  uint64_t accumulate(std::atomic<uint64_t> Thread::* member) const {
-
-    uint64_t sum = 0;
-    for (Thread* th : *this)
-        sum += (th->*member).load(std::memory_order_relaxed);
-    return sum;
-  }
 };
 
 extern ThreadPool Threads;
 
+
+/// ThreadPool::accumulate() sums a counter over all the threads
+
+inline uint64_t ThreadPool::accumulate(Counter c) const {
+
+  uint64_t sum = 0;
+  for (Thread* th : *this)
+      sum += th->counters[c];
+  return sum;
+}
+
 #endif // #ifndef THREAD_H_INCLUDED
@@ -20,10 +20,10 @@
 
 #include <cstring>   // For std::memset
 #include <iostream>
-#include <thread>
 
 #include "bitboard.h"
 #include "misc.h"
+#include "task_pool.h"
 #include "thread.h"
 #include "tt.h"
 #include "uci.h"
@@ -63,9 +63,20 @@ void TranspositionTable::resize(size_t mbSize) {
 
   Threads.main()->wait_for_search_finished();
 
-  aligned_ttmem_free(mem);
+  release();
 
   clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+
+  const std::string sharedName = Options["SharedHash"];
+  if (!sharedName.empty() && sharedName != "<empty>")
+  {
+      if (map_shared(sharedName))
+          return;
+
+      sync_cout << "info string Failed to map shared hash " << sharedName
+                << ", using a private table" << sync_endl;
+  }
+
   table = static_cast<Cluster*>(aligned_ttmem_alloc(clusterCount * sizeof(Cluster), mem));
   if (!mem)
   {
@@ -78,33 +89,131 @@ void TranspositionTable::resize(size_t mbSize) {
 }
 
 
+/// TranspositionTable::map_shared() places the table in the named shared memory
+/// segment, creating it with the requested size if needed. A process attaching
+/// to an existing segment adopts its size. Returns false on failure.
+
+bool TranspositionTable::map_shared(const std::string& name) {
+
+  constexpr uint64_t SharedMagic = 0x5354545348415245ULL;
+
+  size_t size = sizeof(SharedHeader) + clusterCount * sizeof(Cluster);
+  bool created;
+  int lock;
+  void* m = shared_mem_open(name, size, created, lock);
+
+  if (!m)
+      return false;
+
+  SharedHeader* header = static_cast<SharedHeader*>(m);
+
+  if (created)
+  {
+      // The new segment is zero filled, so the table needs no clearing
+      header->clusterCount = clusterCount;
+      header->magic.store(SharedMagic, std::memory_order_release);
+  }
+  else
+  {
+      // Wait until the creating process has filled in the header
+      for (int i = 0; i < 100 && header->magic.load(std::memory_order_acquire) != SharedMagic; ++i)
+          sleep(10);
+
+      if (   header->magic.load(std::memory_order_acquire) != SharedMagic
+          || size < sizeof(SharedHeader) + header->clusterCount * sizeof(Cluster))
+      {
+          shared_mem_close(name, m, size, lock);
+          return false;
+      }
+
+      if (header->clusterCount != clusterCount)
+          sync_cout << "info string Shared hash " << name << " has "
+                    << header->clusterCount * sizeof(Cluster) / (1024 * 1024)
+                    << " MB, the Hash option is ignored" << sync_endl;
+
+      clusterCount = header->clusterCount;
+  }
+
+  shared = header;
+  sharedSize = size;
+  sharedName = name;
+  sharedLock = lock;
+  table = reinterpret_cast<Cluster*>(header + 1);
+  generation8 = shared->generation8;
+  epoch16 = 0; // Shared tables are never stamped, new_game() leaves them alone
+
+  return true;
+}
+
+
+/// TranspositionTable::release() frees the table. A shared table is unmapped,
+/// and the segment is removed if no other process uses it anymore.
+
+void TranspositionTable::release() {
+
+  if (shared)
+      shared_mem_close(sharedName, shared, sharedSize, sharedLock);
+  else
+      aligned_ttmem_free(mem);
+
+  shared = nullptr;
+  mem = nullptr;
+}
+
+
 /// TranspositionTable::clear() initializes the entire transposition table to zero,
-//  in a multi-threaded way.
+//  in a multi-threaded way. A shared table is left alone, as other processes may
+//  be searching with it; new_game(), which comes first on Clear Hash, tells so.
 
 void TranspositionTable::clear() {
 
-  std::vector<std::thread> threads;
+  if (shared)
+      return;
+
+  epoch16 = 0;
 
-  for (size_t idx = 0; idx < Options["Threads"]; ++idx)
+  const size_t workers = Tasks.size();
+
+  if (!workers)
   {
-      threads.emplace_back([this, idx]() {
+      std::memset(static_cast<void*>(table), 0, clusterCount * sizeof(Cluster));
+      return;
+  }
 
-          // Thread binding gives faster search on systems with a first-touch policy
-          if (Options["Threads"] > 8)
-              WinProcGroup::bindThisThread(idx);
+  // Each worker will zero its part of the hash table. The parts are pinned to
+  // the workers, which are bound like the search threads: this gives faster
+  // search on systems with a first-touch policy.
+  TaskPool::Group group;
 
-          // Each thread will zero its part of the hash table
-          const size_t stride = size_t(clusterCount / Options["Threads"]),
-                       start  = size_t(stride * idx),
-                       len    = idx != Options["Threads"] - 1 ?
-                                stride : clusterCount - start;
+  for (size_t idx = 0; idx < workers; ++idx)
+      Tasks.submit_to(idx, group, [this, idx, workers](size_t) {
 
-          std::memset(&table[start], 0, len * sizeof(Cluster));
+          const size_t stride = clusterCount / workers,
+                       start  = stride * idx,
+                       len    = idx != workers - 1 ? stride : clusterCount - start;
+
+          std::memset(static_cast<void*>(&table[start]), 0, len * sizeof(Cluster));
       });
+
+  Tasks.wait(group);
+}
+
+
+/// TranspositionTable::new_game() empties the table for a new game without the
+/// cost of clear(), which takes seconds with a large hash: the entries of the
+/// older games are dropped cluster by cluster as probe() comes across them. The
+/// table is only zeroed when the epoch wraps around.
+
+void TranspositionTable::new_game() {
+
+  if (shared)
+  {
+      sync_cout << "info string Shared hash " << sharedName << " is not cleared" << sync_endl;
+      return;
   }
 
-  for (std::thread& th : threads)
-      th.join();
+  if (++epoch16 == 0)
+      clear();
 }
 
 
@@ -120,9 +229,16 @@ TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
   return found = false, first_entry(0);
 #else
 
-  TTEntry* const tte = first_entry(key);
+  Cluster* const cluster = &table[mul_hi64(key, clusterCount)];
+  TTEntry* const tte = &cluster->entry[0];
   const uint16_t key16 = (uint16_t)key;  // Use the low 16 bits as key inside the cluster
 
+  if (cluster->epoch16 != epoch16) // Entries of an older game
+  {
+      std::memset(cluster->entry, 0, sizeof(cluster->entry));
+      cluster->epoch16 = epoch16;
+  }
+
   for (int i = 0; i < ClusterSize; ++i)
       if (!tte[i].key16 || tte[i].key16 == key16)
       {
@@ -155,7 +271,8 @@ int TranspositionTable::hashfull() const {
   int cnt = 0;
   for (int i = 0; i < 1000; ++i)
       for (int j = 0; j < ClusterSize; ++j)
-          cnt += (table[i].entry[j].genBound8 & 0xF8) == generation8;
+          cnt +=  table[i].epoch16 == epoch16
+              && (table[i].entry[j].genBound8 & 0xF8) == generation8;
 
   return cnt / ClusterSize;
 }
@@ -21,6 +21,9 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <atomic>
+#include <string>
+
 #include "misc.h"
 #include "types.h"
 
@@ -62,6 +65,18 @@ private:
 /// contains information on exactly one position. The size of a Cluster should
 /// divide the size of a cache line for best performance, as the cacheline is
 /// prefetched when possible.
+///
+/// Every cluster is stamped with the epoch of the game its entries belong to.
+/// A new game advances the epoch instead of zeroing the table, and probe()
+/// empties a cluster of an older game when it first visits it.
+///
+/// The table can also live in a named shared memory segment, see the SharedHash
+/// UCI option, so that several engine processes on the same host search with
+/// one table. Entries are written without locking exactly as between threads,
+/// and the generation is kept in a header in front of the clusters so that all
+/// processes age the entries alike. The segment is removed when the last
+/// process using it releases the table, or by the next process mapping it if
+/// all its users died (see shared_mem_open()). It is never cleared.
 
 class TranspositionTable {
 
@@ -69,18 +84,31 @@ class TranspositionTable {
 
   struct Cluster {
     TTEntry entry[ClusterSize];
-    char padding[2]; // Pad to 32 bytes
+    uint16_t epoch16; // Pads to 32 bytes
   };
 
   static_assert(sizeof(Cluster) == 32, "Unexpected Cluster size");
 
+  struct SharedHeader {
+    std::atomic<uint64_t> magic;
+    uint64_t clusterCount;
+    std::atomic<uint8_t> generation8;
+    char padding[64 - 2 * sizeof(uint64_t) - sizeof(std::atomic<uint8_t>)];
+  };
+
+  static_assert(sizeof(SharedHeader) == 64, "Unexpected SharedHeader size");
+
 public:
- ~TranspositionTable() { aligned_ttmem_free(mem); }
-  void new_search() { generation8 += 8; } // Lower 3 bits are used by PV flag and Bound
+ ~TranspositionTable() { release(); }
+  void new_search() { // Lower 3 bits are used by PV flag and Bound
+    generation8 = shared ? uint8_t(shared->generation8 += 8) : uint8_t(generation8 + 8);
+  }
   TTEntry* probe(const Key key, bool& found) const;
   int hashfull() const;
   void resize(size_t mbSize);
   void clear();
+  void new_game();
+  bool is_shared() const { return shared != nullptr; }
 
   TTEntry* first_entry(const Key key) const {
     return &table[mul_hi64(key, clusterCount)].entry[0];
@@ -89,10 +117,18 @@ public:
 private:
   friend struct TTEntry;
 
+  bool map_shared(const std::string& name);
+  void release();
+
   size_t clusterCount;
   Cluster* table;
   void* mem;
+  SharedHeader* shared = nullptr;
+  size_t sharedSize;
+  std::string sharedName;
+  int sharedLock;
   uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
+  uint16_t epoch16;
 };
 
 extern TranspositionTable TT;
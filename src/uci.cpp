@@ -23,8 +23,10 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "evaluate.h"
+#include "mate_search.h"
 #include "movegen.h"
 #include "position.h"
 #include "search.h"
@@ -55,6 +57,9 @@ namespace Learner
   // Learning from the generated game record
   void learn(Position& pos, istringstream& is);
 
+  // Statistics of the game record files
+  void data_stats(Position& pos, istringstream& is);
+
 #if defined(GENSFEN2019)
   // Automatic generation command of teacher phase under development
   void gen_sfen2019(Position& pos, istringstream& is);
@@ -176,6 +181,122 @@ namespace {
   }
 
 
+  // The thread of "analysegame", so that the UCI loop still reads "stop" and
+  // "quit" during the analysis. As every search of the game ends by raising
+  // Threads.stop, a stop request is kept in its own flag until the analysis
+  // checks it between two positions.
+
+  std::thread analysis;
+  std::atomic_bool analysisStop;
+
+  void wait_for_analysis() {
+
+    if (analysis.joinable())
+        analysis.join();
+  }
+
+
+  // analysegame() is called when engine receives the "analysegame" command.
+  // It searches every position of a game, from the last one to the first, so
+  // that each search finds the subtrees of the following positions in the TT,
+  // which is not cleared. The limits are given as for "go", followed by the
+  // game as for "position", for instance:
+  //
+  // analysegame depth 18 startpos moves e2e4 e7e5 g1f3
+  //
+  // Like "go", the command returns at once and the searches run in their own
+  // thread, with their own position. After the output of the searches, a
+  // summary gives for every analysed position in game order the move played,
+  // the score for the side to move and the best move.
+
+  void analysegame(istringstream& is) {
+
+    string token, limits, game;
+    vector<string> moves;
+
+    while (is >> token && token != "startpos" && token != "fen")
+        limits += token + " ";
+
+    if (token != "startpos" && token != "fen")
+        return;
+
+    game = token;
+    while (is >> token && token != "moves")
+        game += " " + token;
+
+    while (is >> token)
+        moves.push_back(token);
+
+    wait_for_analysis();
+    analysisStop = false;
+
+    analysis = std::thread([=]() mutable {
+
+      Position pos;
+      StateListPtr states;
+
+      // The arguments of "position" for the game up to the given ply
+      auto game_at = [&](size_t ply) {
+          string args = game + " moves";
+          for (size_t i = 0; i < ply; ++i)
+              args += " " + moves[i];
+          return args;
+      };
+
+      // Keep the legal part of the move list
+      istringstream full(game_at(moves.size()));
+      position(pos, full, states);
+      moves.resize(states->size() - 1);
+
+      vector<pair<Value, Move>> results(moves.size() + 1);
+      size_t first = results.size(); // First analysed ply
+      uint64_t nodes = 0;
+      TimePoint elapsed = now();
+
+      for (size_t ply = moves.size() + 1; ply-- > 0 && !analysisStop; first = ply)
+      {
+          istringstream ps(game_at(ply));
+          position(pos, ps, states);
+
+          if (!MoveList<LEGAL>(pos).size())
+          {
+              results[ply] = { pos.checkers() ? -VALUE_MATE : VALUE_DRAW, MOVE_NONE };
+              continue;
+          }
+
+          istringstream ls(limits);
+          go(pos, ls, states);
+          Threads.main()->wait_for_search_finished();
+
+          nodes += Threads.nodes_searched();
+          results[ply] = { Threads.main()->bestPreviousScore, Threads.main()->bestMove };
+      }
+
+      elapsed = now() - elapsed + 1;
+
+      for (size_t ply = first; ply < results.size(); ++ply)
+      {
+          sync_cout << "info string ply " << ply;
+
+          if (ply < moves.size())
+              cout << " move " << moves[ply];
+
+          cout << " score " << UCI::value(results[ply].first);
+
+          if (results[ply].second != MOVE_NONE)
+              cout << " bestmove " << UCI::move(results[ply].second, pos.is_chess960());
+
+          cout << sync_endl;
+      }
+
+      sync_cout << "info string analysegame positions " << results.size() - first
+                << " nodes " << nodes
+                << " nps " << 1000 * nodes / elapsed
+                << " time " << elapsed << sync_endl;
+    });
+  }
+
+
   // bench() is called when engine receives the "bench" command. Firstly
   // a list of UCI commands is setup according to bench parameters, then
   // it is run one by one printing a summary at the end.
@@ -183,7 +304,7 @@ namespace {
   void bench(Position& pos, istream& args, StateListPtr& states) {
 
     string token;
-    uint64_t num, nodes = 0, cnt = 1;
+    uint64_t num, nodes = 0, evals = 0, refreshes = 0, proofSize = 0, cnt = 1;
 
     vector<string> list = setup_bench(pos, args);
     num = count_if(list.begin(), list.end(), [](string s) { return s.find("go ") == 0 || s.find("eval") == 0; });
@@ -203,6 +324,11 @@ namespace {
                go(pos, is, states);
                Threads.main()->wait_for_search_finished();
                nodes += Threads.nodes_searched();
+               evals += Threads.accumulate(EVALS);
+               refreshes += Threads.accumulate(NNUE_REFRESHES);
+
+               if (Options["MateSolver"] && cmd.find(" mate ") != string::npos)
+                   proofSize += MateSearch::proof_size();
             }
             else
                sync_cout << "\n" << Eval::trace(pos) << sync_endl;
@@ -225,7 +351,14 @@ namespace {
     cerr << "\n==========================="
          << "\nTotal time (ms) : " << elapsed
          << "\nNodes searched  : " << nodes
-         << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+         << "\nNodes/second    : " << 1000 * nodes / elapsed
+         << "\nEvaluations     : " << evals << endl;
+
+    if (refreshes)
+        cerr << "NNUE refreshes  : " << refreshes << endl;
+
+    if (proofSize)
+        cerr << "Proof size      : " << proofSize << endl;
   }
 
   // The win rate model returns the probability (per mille) of winning given an eval
@@ -361,7 +494,7 @@ void UCI::loop(int argc, char* argv[]) {
 
       if (    token == "quit"
           ||  token == "stop")
-          Threads.stop = true;
+          analysisStop = Threads.stop = true;
 
       // The GUI sends 'ponderhit' to tell us the user has played the expected move.
       // So 'ponderhit' will be sent if we were told to ponder on the same move the
@@ -390,12 +523,15 @@ void UCI::loop(int argc, char* argv[]) {
       // Do not use these commands during a search!
       else if (token == "flip")     pos.flip();
       else if (token == "bench")    bench(pos, is, states);
+      else if (token == "analysegame") analysegame(is);
       else if (token == "d")        sync_cout << pos << sync_endl;
       else if (token == "eval")     sync_cout << Eval::trace(pos) << sync_endl;
       else if (token == "compiler") sync_cout << compiler_info() << sync_endl;
+      else if (token == "tbstats")  sync_cout << Tablebases::mapping_stats() << sync_endl;
 #if defined (EVAL_LEARN)
       else if (token == "gensfen") Learner::gen_sfen(pos, is);
       else if (token == "learn") Learner::learn(pos, is);
+      else if (token == "datastats") Learner::data_stats(pos, is);
 
 #if defined (GENSFEN2019)
 	  // Command to generate teacher phase under development
@@ -419,6 +555,8 @@ void UCI::loop(int argc, char* argv[]) {
           sync_cout << "Unknown command: " << cmd << sync_endl;
 
   } while (token != "quit" && argc == 1); // Command line args are one-shot
+
+  wait_for_analysis();
 }
 
 
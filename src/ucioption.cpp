@@ -23,6 +23,11 @@
 #include <ostream>
 #include <sstream>
 
+#include "analysis_store.h"
+#include "bitboard.h"
+#include "book.h"
+#include "evaluate.h"
+#include "mate_search.h"
 #include "misc.h"
 #include "search.h"
 #include "thread.h"
@@ -37,11 +42,27 @@ UCI::OptionsMap Options; // Global object
 namespace UCI {
 
 /// 'On change' actions, triggered by an option's value change
-void on_clear_hash(const Option&) { Search::clear(); }
+void on_clear_hash(const Option&) { Search::clear(); TT.clear(); }
 void on_hash_size(const Option& o) { TT.resize(size_t(o)); }
+void on_mate_hash(const Option& o) { MateSearch::resize(size_t(o)); }
+void on_shared_hash(const Option&) { TT.resize(size_t(Options["Hash"])); }
+void on_analysis_file(const Option& o) { AnalysisStore::init(o); }
+void on_book_file(const Option& o) { Book::init(o); }
 void on_logger(const Option& o) { start_logger(o); }
+void on_slider_attacks(const Option& o) {
+  Threads.main()->wait_for_search_finished(); // The tables must not switch under a search
+  Bitboards::use_pext(o == "Pext" || (o == "Auto" && Bitboards::pext_is_fast()));
+}
 void on_threads(const Option& o) { Threads.set(size_t(o)); }
 void on_tb_path(const Option& o) { Tablebases::init(o); }
+void on_tb_budget(const Option&) {
+  Threads.main()->wait_for_search_finished(); // Probes pin their tables only under a budget
+  Tablebases::set_mapping_budget(size_t(Options["SyzygyMapCount"]), size_t(Options["SyzygyMapSize"]));
+}
+#if defined(EVAL_NNUE)
+void on_eval_hash(const Option& o) { Eval::useEvalHash = o; }
+void on_eval_nnue(const Option& o) { Eval::useNNUE = o; }
+#endif
 void on_eval_file(const Option& o)
 {
     if (Options["EvalNNUE"])
@@ -72,13 +93,20 @@ void init(OptionsMap& o) {
   o["Threads"]               << Option(1, 1, 512, on_threads);
   o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
   o["Clear Hash"]            << Option(on_clear_hash);
+  o["SharedHash"]            << Option("<empty>", on_shared_hash);
+  o["AnalysisFile"]          << Option("<empty>", on_analysis_file);
   o["MultiPV"]               << Option(1, 1, 500);
+  o["SplitMultiPV"]          << Option(false);
+  o["MateSolver"]            << Option(false);
+  o["MateHash"]              << Option(16, 1, MaxHashMB, on_mate_hash);
   o["Skill Level"]           << Option(20, 0, 20);
   o["Move Overhead"]         << Option(10, 0, 5000);
   o["Slow Mover"]            << Option(100, 10, 1000);
   o["nodestime"]             << Option(0, 0, 10000);
   // how many moves to use a fixed move
   o["BookMoves"]             << Option(16, 0, 10000);
+  o["BookFile"]              << Option("<empty>", on_book_file);
+  o["BestBookMove"]          << Option(false);
   o["Ponder"]                << Option(false);
   o["UCI_Chess960"]          << Option(false);
   o["UCI_AnalyseMode"]       << Option(false);
@@ -89,14 +117,26 @@ void init(OptionsMap& o) {
   o["SyzygyPath"]            << Option("<empty>", on_tb_path);
   o["SyzygyProbeDepth"]      << Option(1, 1, 100);
   o["SyzygyProbeLimit"]      << Option(7, 0, 7);
+  o["SyzygyMapCount"]        << Option(0, 0, 100000, on_tb_budget);
+  o["SyzygyMapSize"]         << Option(0, 0, MaxHashMB, on_tb_budget);
+#if defined(USE_PEXT)
+  o["SliderAttacks"]         << Option("Auto var Auto var Pext var Magic", "Auto", on_slider_attacks);
+#endif
   // Evaluation function file name. When this is changed, it is necessary to reread the evaluation function at the next ucinewgame timing.
   // Without the preceding "./", some GUIs can not load he net file.
+#if defined(EMBEDDED_NNUE)
+  // Use the network linked into the binary unless a file is given.
+  o["EvalFile"]              << Option("<embedded>", on_eval_file);
+#else
   o["EvalFile"]              << Option("./eval/nn.bin", on_eval_file);
+#endif
 #if defined(EVAL_LEARN)
   // When learning the evaluation function, you can change the folder to save the evaluation function.
   // Evalsave by default. This folder shall be prepared in advance.
   // Automatically dig a folder under this folder like "0/", "1/", ... and save the evaluation function file there.
   o["EvalSaveDir"] << Option("evalsave");
+  // Save the evaluation function in the compressed container.
+  o["EvalSaveCompressed"] << Option(false);
 #endif
   // When the evaluation function is loaded at the ucinewgame timing, it is necessary to convert the new evaluation function.
   // I want to hit the test eval convert command, but there is no new evaluation function
@@ -104,8 +144,13 @@ void init(OptionsMap& o) {
   // Therefore, with this hidden option, you can suppress the loading of the evaluation function when ucinewgame,
   // Hit the test eval convert command.
   o["SkipLoadingEval"]       << Option(false);
+#if defined(EVAL_NNUE)
+  o["EvalNNUE"]              << Option(true, on_eval_nnue);
+  o["UseEvalHash"]           << Option(false, on_eval_hash);
+#else
   o["EvalNNUE"]              << Option(true);
-  o["UseEvalHash"]           << Option(false);  
+  o["UseEvalHash"]           << Option(false);
+#endif
 }
 
 
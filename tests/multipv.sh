@@ -0,0 +1,41 @@
+#!/bin/bash
+# verify that split MultiPV reports all the requested lines with several thread groups
+
+error()
+{
+  echo "multipv testing failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+echo "multipv testing started"
+
+cat << EOF > multipv.exp
+   set timeout 120
+   lassign \$argv threads multipv limit
+   spawn ./stockfish
+   send "setoption name Threads value \$threads\\nsetoption name MultiPV value \$multipv\\n"
+   send "setoption name SplitMultiPV value true\\nposition startpos\\ngo \$limit\\n"
+   expect "bestmove" {} timeout {exit 1}
+   send "quit\\n"
+   expect eof
+EOF
+
+# count the distinct first moves of the lines printed last, starting at multipv 1
+lines()
+{
+  expect multipv.exp "$@" | tr -d '\r' | awk '
+    / multipv 1 / { delete moves }
+    / multipv / { for (i = 1; i < NF; i++) if ($i == "pv") { moves[$(i + 1)] = 1; break } }
+    END { n = 0; for (m in moves) n++; print n }'
+}
+
+[ "$(lines 6 3 "depth 14")" -eq 3 ]
+[ "$(lines 8 4 "depth 16")" -eq 4 ]
+[ "$(lines 4 4 "movetime 2000")" -eq 4 ]
+[ "$(lines 3 5 "depth 12")" -eq 5 ]
+[ "$(lines 2 2 "depth 12")" -eq 2 ]
+
+rm multipv.exp
+
+echo "multipv testing OK"